@@ -0,0 +1,53 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include "hal/hal.h"
+#include <atomic>
+
+struct BootPhase
+{
+  const char *name;
+  int64_t startMicros; // hal::monotonicMicros(), i.e. since boot
+  int64_t endMicros;   // 0 while it runs
+};
+
+// When each boot phase started and ended. setup() and the boot tasks run
+// phases side by side, so slots are handed out atomically and each one is
+// only written by the task running that phase.
+class BootTimeline
+{
+public:
+  static const size_t MAX_PHASES = 16;
+
+  // Returns the handle for end(); phases past MAX_PHASES are not kept
+  size_t begin(const char *name)
+  {
+    size_t phase = used.fetch_add(1);
+    if (phase < MAX_PHASES)
+    {
+      phases[phase] = {name, hal::monotonicMicros(), 0};
+    }
+    return phase;
+  }
+
+  void end(size_t phase)
+  {
+    if (phase < MAX_PHASES)
+    {
+      phases[phase].endMicros = hal::monotonicMicros();
+    }
+  }
+
+  size_t count() const
+  {
+    size_t begun = used.load();
+    return begun < MAX_PHASES ? begun : MAX_PHASES;
+  }
+  const BootPhase &phase(size_t phase) const { return phases[phase]; }
+
+private:
+  BootPhase phases[MAX_PHASES] = {};
+  std::atomic<size_t> used{0};
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include "broadcast_benchmark.h"
+#include "event_codec.h"
+#include "press_pipeline.h"
+
+BroadcastCost measureBroadcast(AsyncWebSocket &ws, int rounds, std::function<void()> settle)
+{
+  const size_t FRAME_SIZE = PressPipeline::MAX_BATCH_SIZE * (EVENT_JSON_MAX_LENGTH + 1) + 2;
+  static char frame[FRAME_SIZE];
+  int header = snprintf(frame, sizeof(frame), "{\"benchmark\":%u,\"padding\":\"", (unsigned)FRAME_SIZE);
+  memset(frame + header, 'x', FRAME_SIZE - header - 2);
+  frame[FRAME_SIZE - 2] = '"';
+  frame[FRAME_SIZE - 1] = '}';
+
+  uint64_t copyMicros = 0;
+  uint64_t sharedMicros = 0;
+  int64_t copyHeap = 0;
+  int64_t sharedHeap = 0;
+  for (int round = 0; round < rounds; round++)
+  {
+    size_t heapBefore = hal::heapInUse();
+    unsigned long startMicros = micros();
+    for (AsyncWebSocketClient &client : ws.getClients())
+    {
+      client.text(frame, FRAME_SIZE);
+    }
+    copyMicros += micros() - startMicros;
+    copyHeap += (int64_t)hal::heapInUse() - (int64_t)heapBefore;
+    settle();
+
+    heapBefore = hal::heapInUse();
+    startMicros = micros();
+    AsyncWebSocketSharedBuffer shared = std::make_shared<std::vector<uint8_t>>((const uint8_t *)frame, (const uint8_t *)frame + FRAME_SIZE);
+    ws.textAll(shared);
+    sharedMicros += micros() - startMicros;
+    shared.reset();
+    sharedHeap += (int64_t)hal::heapInUse() - (int64_t)heapBefore;
+    settle();
+  }
+
+  BroadcastCost cost;
+  cost.clients = ws.count();
+  cost.frameBytes = FRAME_SIZE;
+  cost.copyMicros = (float)copyMicros / rounds;
+  cost.sharedMicros = (float)sharedMicros / rounds;
+  cost.copyHeap = copyHeap / rounds;
+  cost.sharedHeap = sharedHeap / rounds;
+  return cost;
+}
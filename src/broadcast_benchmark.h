@@ -0,0 +1,27 @@
+#ifndef BROADCAST_BENCHMARK_H
+#define BROADCAST_BENCHMARK_H
+
+#include "hal/hal.h"
+#include <functional>
+
+// Averages over the rounds of what it cost to queue one full-size batch
+// frame for every connected client: the time to queue it and the heap the
+// queued frames hold, once copied per client and once shared
+struct BroadcastCost
+{
+  size_t clients;
+  size_t frameBytes;
+  float copyMicros;
+  float sharedMicros;
+  int32_t copyHeap;
+  int32_t sharedHeap;
+};
+
+// Queues the frame to every client of ws, per client with
+// client.text(const char *, size_t) and then as one shared buffer through
+// ws.textAll(), rounds times each. Heap is read before the queues drain;
+// settle() lets them drain between the two, e.g. a delay on the device or
+// draining the loopback sockets on the host. The page ignores the frames.
+BroadcastCost measureBroadcast(AsyncWebSocket &ws, int rounds, std::function<void()> settle);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef CHANNEL_CONFIG_H
+#define CHANNEL_CONFIG_H
+
+#include <stdint.h>
+
+// How a channel's pulses reach the pipeline
+enum class CaptureBackend : uint8_t
+{
+  Interrupt,   // Pin interrupt per pulse, debounced in software
+  PulseCounter // PCNT peripheral, harvested periodically
+};
+
+// One metered input. The table lives in config.h; a channel's position in
+// it is the channel number in the log and on the WebSocket.
+struct ChannelConfig
+{
+  const char *name;
+  uint8_t pin;
+  CaptureBackend backend;
+  uint8_t pulseCounterUnit; // PCNT unit, PulseCounter backend only
+  unsigned long debounceMs; // Interrupt backend, or a PCNT unit that fails to start
+  float unitsPerPulse;
+  const char *unit; // What unitsPerPulse is in, e.g. "m3" or "kWh"
+};
+
+#endif
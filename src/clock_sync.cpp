@@ -0,0 +1,27 @@
+#include "clock_sync.h"
+
+void ClockSync::onSync(int64_t monotonicMicros, int64_t ntpEpochMicros, int64_t localEpochMicros)
+{
+  if (syncStats.syncs++ == 0)
+  {
+    syncStats.firstSyncMicros = monotonicMicros;
+    syncStats.lastSyncMicros = monotonicMicros;
+    syncStats.lastErrorMicros = 0;
+    return;
+  }
+
+  int64_t error = ntpEpochMicros - localEpochMicros;
+  int64_t magnitude = error < 0 ? -error : error;
+  syncStats.lastErrorMicros = error;
+  syncStats.maxErrorMicros = magnitude > syncStats.maxErrorMicros ? magnitude : syncStats.maxErrorMicros;
+
+  int64_t elapsed = monotonicMicros - syncStats.lastSyncMicros;
+  syncStats.lastSyncMicros = monotonicMicros;
+  if (elapsed <= 0)
+  {
+    return;
+  }
+  float drift = (float)error * 1e6f / (float)elapsed;
+  syncStats.driftPpm = driftKnown ? syncStats.driftPpm + DRIFT_SMOOTHING * (drift - syncStats.driftPpm) : drift;
+  driftKnown = true;
+}
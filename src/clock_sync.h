@@ -0,0 +1,54 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+// Wall clocks that have not been set yet read 1970
+const uint32_t EPOCH_VALID_AFTER_SECONDS = 1600000000;
+const int64_t EPOCH_VALID_AFTER_MICROS = (int64_t)EPOCH_VALID_AFTER_SECONDS * 1000000;
+
+inline bool wallClockSet(int64_t epochMicros)
+{
+  return epochMicros >= EPOCH_VALID_AFTER_MICROS;
+}
+
+inline bool wallClockSetSeconds(uint32_t epochSeconds)
+{
+  return epochSeconds >= EPOCH_VALID_AFTER_SECONDS;
+}
+
+struct ClockSyncStats
+{
+  uint32_t syncs;
+  int64_t firstSyncMicros; // hal::monotonicMicros() of the first answer, 0 before
+  int64_t lastSyncMicros;
+  int64_t lastErrorMicros; // NTP minus the local clock at the last answer
+  int64_t maxErrorMicros;  // Largest magnitude since the first answer
+  float driftPpm;          // Positive when the local clock runs slow
+};
+
+// Keeps track of how far the local clock wanders between NTP answers. SNTP
+// runs in the background and resyncs on its own; each answer is handed to
+// onSync() with the local wall clock read just before it is applied, so
+// the error is what built up since the previous answer. The drift is that
+// error over the time in between, smoothed over the last few answers.
+//
+// The first answer sets a clock that was never set and only starts the
+// bookkeeping.
+class ClockSync
+{
+public:
+  // Weight of the newest interval in the smoothed drift
+  static constexpr float DRIFT_SMOOTHING = 0.25f;
+
+  void onSync(int64_t monotonicMicros, int64_t ntpEpochMicros, int64_t localEpochMicros);
+
+  bool synced() const { return syncStats.syncs > 0; }
+  const ClockSyncStats &stats() const { return syncStats; }
+
+private:
+  ClockSyncStats syncStats = {};
+  bool driftKnown = false;
+};
+
+#endif
@@ -1,12 +1,46 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "channel_config.h"
+#include "task_config.h"
 
 namespace config {
     const char* ssid = "SSID";
     const char* password = "PASSWORD";
     const char* wifiConfigFile = "/wifiConfig.txt";
+    // Boot connects straight to the last access point on its channel and
+    // keeps the last DHCP lease as a static address for up to this many
+    // boots in a row before asking DHCP again. 0 always asks DHCP.
+    const uint8_t WifiLeaseReuseBoots = 20;
     const String ButtonLogPath = "/ButtonLog.txt";
+    // Store the button log as fixed-size binary records instead of JSON lines
+    const bool UseBinaryLog = false;
+    const String ButtonLogBinaryPath = "/ButtonLog.bin";
+    // Segments of the button log; an old single-file log is moved in here
+    const char* ButtonLogDirectory = "/log";
+    // Per minute, hour and day pulse totals next to the log
+    const char* RollupDirectory = "/rollup";
+    // Metered inputs, at most PressPipeline::MAX_CHANNELS. Channels are
+    // numbered by position, so add new meters at the end. For example:
+    //   {"Water", 5, CaptureBackend::Interrupt, 0, 250, 1.0f, "L"},
+    //   {"Gas", 18, CaptureBackend::Interrupt, 0, 250, 0.01f, "m3"},
+    //   {"Electricity", 19, CaptureBackend::PulseCounter, 0, 0, 0.001f, "kWh"},
+    constexpr ChannelConfig Channels[] = {
+        {"Button", 4, CaptureBackend::Interrupt, 0, 250, 1.0f, "presses"},
+    };
+    constexpr size_t ChannelCount = sizeof(Channels) / sizeof(Channels[0]);
+    // The capture task turns pulses into records, the persistence task
+    // logs and broadcasts them. Capture never waits on flash or sockets,
+    // so keep it above persistence and loop().
+    constexpr TaskConfig CaptureTask = {"capture", 1, 5, 4096};
+    constexpr TaskConfig PersistenceTask = {"persist", 0, 2, 8192};
+    // Brings up WiFi, SNTP and the web server next to setup(), then ends
+    constexpr TaskConfig NetworkTask = {"network", 0, 1, 4096};
+    // Both tasks sleep until something is due. With nothing in flight the
+    // persistence task still wakes this often for rate pushes and rollups,
+    // and this often while it streams history to a client.
+    const unsigned long PersistenceIdleMs = 1000;
+    const unsigned long ReplayPollMs = 10;
 }
 
 #endif
\ No newline at end of file
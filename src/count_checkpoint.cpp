@@ -0,0 +1,24 @@
+#include "count_checkpoint.h"
+
+void restoreCounts(PressPipeline &pipeline, SegmentedLog &log, const CountCheckpoint &checkpoint)
+{
+  uint32_t nextSequence = checkpoint.sequenceLimit > checkpoint.nextSequence ? checkpoint.sequenceLimit
+                                                                             : checkpoint.nextSequence;
+  nextSequence = nextSequence > 0 ? nextSequence : 1;
+
+  for (uint8_t channel = 0; channel < pipeline.channelCount(); channel++)
+  {
+    ulong count = checkpoint.counts[channel];
+    EventRecord record;
+    if (log.readLast(checkpoint.segment, checkpoint.offset, record, channel))
+    {
+      count = record.count;
+      if (record.sequence >= nextSequence)
+      {
+        nextSequence = record.sequence + 1;
+      }
+    }
+    pipeline.restore(channel, count);
+  }
+  pipeline.restoreSequence(nextSequence);
+}
@@ -0,0 +1,29 @@
+#ifndef COUNT_CHECKPOINT_H
+#define COUNT_CHECKPOINT_H
+
+#include "hal/hal.h"
+#include "press_pipeline.h"
+#include "segmented_log.h"
+
+// Counts as last checkpointed: each channel's count at the last flushed
+// record, where the log ended at that point and the sequence numbers handed
+// out by then. On the device it lives in NVS.
+struct CountCheckpoint
+{
+  uint32_t segment;
+  size_t offset;
+  uint32_t nextSequence;
+  // Numbers reserved ahead of the pipeline, which records the log lost may
+  // have carried
+  uint32_t sequenceLimit;
+  ulong counts[PressPipeline::MAX_CHANNELS];
+};
+
+// Restores the pipeline's counts and sequence at boot. Only the records
+// written after the checkpoint are scanned, once per channel for its last
+// record; a channel without one keeps its checkpointed count. The next
+// sequence is past the checkpoint, the reserved limit and every record
+// found, and never 0, which is left to records logged before sequences.
+void restoreCounts(PressPipeline &pipeline, SegmentedLog &log, const CountCheckpoint &checkpoint);
+
+#endif
@@ -0,0 +1,281 @@
+#include "event_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const uint8_t BINARY_LOG_MAGIC[4] = {'P', 'L', 'O', 'G'};
+
+static void putU16(uint8_t *out, uint16_t value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+}
+
+static void putU32(uint8_t *out, uint32_t value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+static void putU64(uint8_t *out, uint64_t value)
+{
+  putU32(out, (uint32_t)value);
+  putU32(out + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t getU16(const uint8_t *in)
+{
+  return in[0] | (in[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static uint64_t getU64(const uint8_t *in)
+{
+  return (uint64_t)getU32(in) | ((uint64_t)getU32(in + 4) << 32);
+}
+
+static size_t putVarint(uint8_t *out, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+// Advances at, false when the varint runs past end
+static bool getVarint(const uint8_t *&at, const uint8_t *end, uint64_t &value)
+{
+  value = 0;
+  for (int shift = 0; at < end && shift < 64; shift += 7)
+  {
+    uint8_t byte = *at++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+  // Bitwise CRC-32 (IEEE), records are short enough to skip the table
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+size_t encodeEventJson(const EventRecord &record, char *out, size_t capacity)
+{
+  // Fixed layout, so the frame is built on the stack instead of in a JsonDocument
+  int length = snprintf(out, capacity, "{\"seq\":%lu,\"channel\":%u,\"ts\":%lld,\"count\":%lu}",
+                        (unsigned long)record.sequence, (unsigned)record.channel,
+                        (long long)record.epochMillis, (unsigned long)record.count);
+  if (length < 0)
+  {
+    return 0;
+  }
+  return (size_t)length < capacity ? length : capacity - 1;
+}
+
+// Lines logged before epoch milliseconds carried a local-time string
+static bool decodeLegacyTimestamp(const char *line, int64_t &epochMillis)
+{
+  const char *timestampField = strstr(line, "\"buttonPressTimestamp\":\"");
+  if (!timestampField)
+  {
+    return false;
+  }
+
+  // Milliseconds are optional, older lines stop at the second
+  struct tm timeinfo = {};
+  int milliseconds = 0;
+  if (sscanf(timestampField + strlen("\"buttonPressTimestamp\":\""), "%d-%d-%d %d:%d:%d.%d",
+             &timeinfo.tm_year, &timeinfo.tm_mon, &timeinfo.tm_mday,
+             &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec, &milliseconds) < 6)
+  {
+    return false;
+  }
+  timeinfo.tm_year -= 1900;
+  timeinfo.tm_mon -= 1;
+  timeinfo.tm_isdst = -1;
+  epochMillis = (int64_t)mktime(&timeinfo) * 1000 + (milliseconds >= 0 && milliseconds < 1000 ? milliseconds : 0);
+  return true;
+}
+
+bool decodeEventJson(const char *line, EventRecord &record)
+{
+  const char *timeField = strstr(line, "\"ts\":");
+  if (timeField)
+  {
+    record.epochMillis = strtoll(timeField + strlen("\"ts\":"), nullptr, 10);
+  }
+  else if (!decodeLegacyTimestamp(line, record.epochMillis))
+  {
+    return false;
+  }
+
+  const char *countField = strstr(line, "\"count\":");
+  const char *legacyCountField = strstr(line, "\"buttonPressCount\":");
+  if (!countField && !legacyCountField)
+  {
+    return false;
+  }
+
+  const char *sequenceField = strstr(line, "\"seq\":");
+  record.sequence = sequenceField ? strtoul(sequenceField + strlen("\"seq\":"), nullptr, 10) : 0;
+  const char *channelField = strstr(line, "\"channel\":");
+  record.channel = channelField ? strtoul(channelField + strlen("\"channel\":"), nullptr, 10) : 0;
+  record.reserved = 0;
+  record.count = countField ? strtoul(countField + strlen("\"count\":"), nullptr, 10)
+                            : strtoul(legacyCountField + strlen("\"buttonPressCount\":"), nullptr, 10);
+  return true;
+}
+
+size_t encodeEventJsonArray(const EventRecord *records, size_t count, char *out)
+{
+  size_t length = 0;
+  out[length++] = '[';
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i > 0)
+    {
+      out[length++] = ',';
+    }
+    length += encodeEventJson(records[i], out + length, EVENT_JSON_MAX_LENGTH);
+  }
+  out[length++] = ']';
+  return length;
+}
+
+size_t encodeEventFrame(const EventRecord *records, size_t count, uint8_t *out)
+{
+  uint32_t sequence = count > 0 ? records[0].sequence : 0;
+  int64_t epochMillis = count > 0 ? records[0].epochMillis : 0;
+  out[0] = EVENT_FRAME_VERSION;
+  out[1] = (uint8_t)count;
+  putU32(out + 2, sequence);
+  putU64(out + 6, (uint64_t)epochMillis);
+
+  size_t length = EVENT_FRAME_HEADER_SIZE;
+  for (size_t i = 0; i < count; i++)
+  {
+    out[length++] = records[i].channel;
+    length += putVarint(out + length, zigzag((int64_t)records[i].sequence - sequence));
+    length += putVarint(out + length, zigzag(records[i].epochMillis - epochMillis));
+    length += putVarint(out + length, records[i].count);
+    sequence = records[i].sequence;
+    epochMillis = records[i].epochMillis;
+  }
+  return length;
+}
+
+bool decodeEventFrame(const uint8_t *in, size_t length, EventRecord *records, size_t capacity, size_t &count)
+{
+  if (length < EVENT_FRAME_HEADER_SIZE || in[0] != EVENT_FRAME_VERSION || in[1] > capacity)
+  {
+    return false;
+  }
+
+  count = in[1];
+  int64_t sequence = getU32(in + 2);
+  int64_t epochMillis = (int64_t)getU64(in + 6);
+  const uint8_t *at = in + EVENT_FRAME_HEADER_SIZE;
+  const uint8_t *end = in + length;
+  for (size_t i = 0; i < count; i++)
+  {
+    uint64_t sequenceDelta;
+    uint64_t epochDelta;
+    uint64_t pressCount;
+    if (at >= end)
+    {
+      return false;
+    }
+    records[i].channel = *at++;
+    if (!getVarint(at, end, sequenceDelta) || !getVarint(at, end, epochDelta) || !getVarint(at, end, pressCount))
+    {
+      return false;
+    }
+    sequence += unzigzag(sequenceDelta);
+    epochMillis += unzigzag(epochDelta);
+    records[i].sequence = (uint32_t)sequence;
+    records[i].epochMillis = epochMillis;
+    records[i].count = (uint32_t)pressCount;
+    records[i].reserved = 0;
+  }
+  return at == end;
+}
+
+size_t encodeBinaryLogHeader(uint8_t *out)
+{
+  memcpy(out, BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC));
+  putU16(out + 4, BINARY_LOG_VERSION);
+  putU16(out + 6, BINARY_LOG_RECORD_SIZE);
+  putU32(out + 8, 0);
+  putU32(out + 12, crc32(out, 12));
+  return BINARY_LOG_HEADER_SIZE;
+}
+
+bool decodeBinaryLogHeader(const uint8_t *in)
+{
+  return memcmp(in, BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC)) == 0 &&
+         getU16(in + 4) == BINARY_LOG_VERSION &&
+         getU16(in + 6) == BINARY_LOG_RECORD_SIZE &&
+         getU32(in + 12) == crc32(in, 12);
+}
+
+size_t encodeEventBinary(const EventRecord &record, uint8_t *out)
+{
+  putU32(out, record.sequence);
+  putU32(out + 4, record.epochSeconds());
+  putU16(out + 8, (uint16_t)(record.epochMillis % 1000));
+  out[10] = record.channel;
+  out[11] = 0;
+  putU32(out + 12, record.count);
+  putU32(out + 16, crc32(out, 16));
+  return BINARY_LOG_RECORD_SIZE;
+}
+
+bool decodeEventBinary(const uint8_t *in, EventRecord &record)
+{
+  if (getU32(in + 16) != crc32(in, 16))
+  {
+    return false;
+  }
+
+  record.sequence = getU32(in);
+  record.epochMillis = (int64_t)getU32(in + 4) * 1000 + getU16(in + 8) % 1000;
+  record.channel = in[10];
+  record.reserved = 0;
+  record.count = getU32(in + 12);
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef EVENT_CODEC_H
+#define EVENT_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "event_record.h"
+
+// Byte-level encodings of EventRecord. Plain C++ without Arduino types, so
+// the host-side tools in tools/ share it with the firmware.
+
+const size_t EVENT_JSON_MAX_LENGTH = 80;
+// Longest line decodeEventJson() is handed, covering the longer lines of
+// the buttonPressTimestamp format that older logs still hold
+const size_t EVENT_JSON_LINE_MAX_LENGTH = 120;
+
+// Binary log layout, all fields little-endian:
+//   header: magic "PLOG", u16 version, u16 record size, u32 reserved, u32 CRC32
+//   record: u32 sequence, u32 epoch seconds, u16 milliseconds, u8 channel,
+//           u8 reserved, u32 count, u32 CRC32 of the preceding 16 bytes
+// The epoch is split so logs written before records carried milliseconds
+// still read; it holds every time up to 2106.
+const size_t BINARY_LOG_HEADER_SIZE = 16;
+const size_t BINARY_LOG_RECORD_SIZE = 20;
+const uint16_t BINARY_LOG_VERSION = 1;
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+// {"seq":N,"channel":N,"ts":<epoch ms>,"count":N}, no trailing newline.
+// Times stay integers; the browser and the CSV export format them.
+// Returns the length written, not counting the terminator.
+size_t encodeEventJson(const EventRecord &record, char *out, size_t capacity);
+// Parses a line written by encodeEventJson(). Lines logged before "seq" or
+// "channel" were added decode with 0 for those. Older lines with a local
+// "buttonPressTimestamp" string and "buttonPressCount" still decode, so a
+// log keeps working after an update; tools/log_convert rewrites one.
+bool decodeEventJson(const char *line, EventRecord &record);
+
+// [record,...] of encodeEventJson() records; out holds
+// count * (EVENT_JSON_MAX_LENGTH + 1) + 2 bytes. Returns the length written.
+size_t encodeEventJsonArray(const EventRecord *records, size_t count, char *out);
+
+// Binary WebSocket frames, sent instead of JSON arrays to clients that ask
+// for EVENT_FRAME_PROTOCOL in Sec-WebSocket-Protocol. Little-endian:
+//   header: u8 version, u8 record count, u32 sequence, i64 epoch ms
+//   record: u8 channel, varint sequence delta, varint epoch ms delta,
+//           varint count
+// Deltas are from the previous record, the first one's from the header,
+// and zigzag encoded so a step back costs as little as a step forward.
+// Varints are LEB128: 7 bits a byte, low bits first, high bit set on all
+// but the last byte. A press in a batch usually takes 6 or 7 bytes.
+const char EVENT_FRAME_PROTOCOL[] = "pulse.v1";
+const uint8_t EVENT_FRAME_VERSION = 1;
+const size_t EVENT_FRAME_HEADER_SIZE = 14;
+// Channel plus varints of at most 5, 10 and 5 bytes
+const size_t EVENT_FRAME_RECORD_MAX_SIZE = 21;
+const size_t EVENT_FRAME_MAX_RECORDS = 255;
+
+// At most EVENT_FRAME_MAX_RECORDS records; out holds EVENT_FRAME_HEADER_SIZE
+// + count * EVENT_FRAME_RECORD_MAX_SIZE bytes. Returns the length written.
+size_t encodeEventFrame(const EventRecord *records, size_t count, uint8_t *out);
+// False for a frame of another version, one cut short, or one holding more
+// than capacity records
+bool decodeEventFrame(const uint8_t *in, size_t length, EventRecord *records, size_t capacity, size_t &count);
+
+size_t encodeBinaryLogHeader(uint8_t *out);
+bool decodeBinaryLogHeader(const uint8_t *in);
+size_t encodeEventBinary(const EventRecord &record, uint8_t *out);
+// False when the CRC does not match, e.g. after a torn write
+bool decodeEventBinary(const uint8_t *in, EventRecord &record);
+
+#endif
@@ -0,0 +1,149 @@
+#include "event_log_format.h"
+
+bool EventLogFormat::readLast(File &file, size_t fromOffset, EventRecord &record, int channel) const
+{
+  if (!open(file))
+  {
+    return false;
+  }
+  if (fromOffset > file.position() && fromOffset <= file.size())
+  {
+    file.seek(fromOffset);
+  }
+
+  bool found = false;
+  EventRecord next;
+  while (readNext(file, next))
+  {
+    if (channel < 0 || next.channel == channel)
+    {
+      record = next;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// JSON lines
+
+size_t JsonLinesFormat::encode(const EventRecord &record, uint8_t *out) const
+{
+  size_t length = encodeEventJson(record, (char *)out, EVENT_JSON_MAX_LENGTH);
+  out[length++] = '\n';
+  return length;
+}
+
+bool JsonLinesFormat::open(File &file) const
+{
+  return file.seek(0);
+}
+
+bool JsonLinesFormat::readNext(File &file, EventRecord &record) const
+{
+  // One byte over the longest line, so a line that fills it is overlong
+  char line[EVENT_JSON_LINE_MAX_LENGTH + 2];
+  const size_t capacity = sizeof(line) - 1;
+  while (file.available())
+  {
+    size_t length = file.readBytesUntil('\n', line, capacity);
+    if (length == capacity)
+    {
+      // Skip the rest of it rather than decode it as lines of its own
+      while (length == capacity)
+      {
+        length = file.readBytesUntil('\n', line, capacity);
+      }
+      continue;
+    }
+    line[length] = '\0';
+    if (decodeEventJson(line, record))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Binary
+
+size_t BinaryLogFormat::prepareAppend(size_t fileSize, uint8_t *out) const
+{
+  if (fileSize == 0)
+  {
+    return encodeBinaryLogHeader(out);
+  }
+
+  // Pad a torn record out to a whole one; its CRC fails and readers skip it
+  size_t partial = fileSize < BINARY_LOG_HEADER_SIZE
+                       ? 0
+                       : (fileSize - BINARY_LOG_HEADER_SIZE) % BINARY_LOG_RECORD_SIZE;
+  if (partial == 0)
+  {
+    return 0;
+  }
+  size_t padding = BINARY_LOG_RECORD_SIZE - partial;
+  memset(out, 0, padding);
+  return padding;
+}
+
+size_t BinaryLogFormat::encode(const EventRecord &record, uint8_t *out) const
+{
+  return encodeEventBinary(record, out);
+}
+
+bool BinaryLogFormat::open(File &file) const
+{
+  uint8_t header[BINARY_LOG_HEADER_SIZE];
+  if (!file.seek(0) || file.read(header, sizeof(header)) != sizeof(header))
+  {
+    return false;
+  }
+  if (!decodeBinaryLogHeader(header))
+  {
+    Serial.println("Binary log header is invalid");
+    return false;
+  }
+  return true;
+}
+
+bool BinaryLogFormat::readNext(File &file, EventRecord &record) const
+{
+  uint8_t bytes[BINARY_LOG_RECORD_SIZE];
+  while (file.read(bytes, sizeof(bytes)) == sizeof(bytes))
+  {
+    if (decodeEventBinary(bytes, record))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BinaryLogFormat::readLast(File &file, size_t fromOffset, EventRecord &record, int channel) const
+{
+  if (!open(file))
+  {
+    return false;
+  }
+
+  // Walk back from the last whole record; only damaged records cost a read
+  size_t records = (file.size() - BINARY_LOG_HEADER_SIZE) / BINARY_LOG_RECORD_SIZE;
+  while (records > 0 && recordOffset(records - 1) >= fromOffset)
+  {
+    records--;
+    uint8_t bytes[BINARY_LOG_RECORD_SIZE];
+    if (seekRecord(file, records) &&
+        file.read(bytes, sizeof(bytes)) == sizeof(bytes) &&
+        decodeEventBinary(bytes, record) &&
+        (channel < 0 || record.channel == channel))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BinaryLogFormat::seekRecord(File &file, uint32_t index) const
+{
+  return file.seek(recordOffset(index));
+}
@@ -0,0 +1,62 @@
+#ifndef EVENT_LOG_FORMAT_H
+#define EVENT_LOG_FORMAT_H
+
+#include "hal/hal.h"
+#include "event_codec.h"
+#include "event_record.h"
+
+// On-flash layout of the button log. LogWriter writes through it and boot
+// recovery and history replay read through it, so the formats are
+// interchangeable.
+class EventLogFormat
+{
+public:
+  // Largest encode() or prepareAppend() output
+  static const size_t MAX_ENCODED_SIZE = EVENT_JSON_MAX_LENGTH + 1;
+
+  virtual ~EventLogFormat() {}
+
+  // Bytes to write before the first append to a file of fileSize bytes:
+  // a header for a new file, or padding after a torn write.
+  virtual size_t prepareAppend(size_t fileSize, uint8_t *out) const = 0;
+  virtual size_t encode(const EventRecord &record, uint8_t *out) const = 0;
+
+  // Checks the file and moves to the first record
+  virtual bool open(File &file) const = 0;
+  // Reads the record at the file position, skipping damaged ones.
+  // False at the end of the log.
+  virtual bool readNext(File &file, EventRecord &record) const = 0;
+  // Last intact record at or after fromOffset, of one channel when
+  // channel is not negative
+  virtual bool readLast(File &file, size_t fromOffset, EventRecord &record, int channel = -1) const;
+};
+
+// One encodeEventJson() object per line, the original log format
+class JsonLinesFormat : public EventLogFormat
+{
+public:
+  size_t prepareAppend(size_t fileSize, uint8_t *out) const override { return 0; }
+  size_t encode(const EventRecord &record, uint8_t *out) const override;
+  bool open(File &file) const override;
+  bool readNext(File &file, EventRecord &record) const override;
+};
+
+// Fixed-size records with a CRC behind a small header, see event_codec.h.
+// Record N sits at a computed offset and torn writes fail their CRC.
+class BinaryLogFormat : public EventLogFormat
+{
+public:
+  size_t prepareAppend(size_t fileSize, uint8_t *out) const override;
+  size_t encode(const EventRecord &record, uint8_t *out) const override;
+  bool open(File &file) const override;
+  bool readNext(File &file, EventRecord &record) const override;
+  bool readLast(File &file, size_t fromOffset, EventRecord &record, int channel = -1) const override;
+
+  static size_t recordOffset(uint32_t index)
+  {
+    return BINARY_LOG_HEADER_SIZE + (size_t)index * BINARY_LOG_RECORD_SIZE;
+  }
+  bool seekRecord(File &file, uint32_t index) const;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef EVENT_RECORD_H
+#define EVENT_RECORD_H
+
+#include <stdint.h>
+
+// One captured press, kept as plain data so the pool holding it can be
+// allocated once at compile time.
+struct EventRecord
+{
+  int64_t epochMillis;     // Wall-clock time of the press, UTC
+  uint32_t sequence;       // Increments by one for every captured press
+  uint32_t count;          // Running press count after this press
+  uint8_t channel;         // Input the press was captured on
+  uint8_t reserved;
+
+  uint32_t epochSeconds() const { return (uint32_t)(epochMillis / 1000); }
+};
+
+#endif
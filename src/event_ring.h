@@ -0,0 +1,66 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Fixed-capacity single-producer/single-consumer ring buffer.
+//
+// The producer (an ISR) only writes `head`, the consumer (the main task)
+// only writes `tail`, so neither side needs a lock or a critical section.
+// When the ring is full the new item is dropped and counted in
+// overflowCount() instead of overwriting unread items.
+template <typename T, size_t Capacity>
+class EventRing
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "EventRing capacity must be a power of two");
+
+public:
+  // Producer side, safe to call from an IRAM ISR.
+  inline __attribute__((always_inline)) bool push(const T &item)
+  {
+    const uint32_t currentHead = head.load(std::memory_order_relaxed);
+    if (currentHead - tail.load(std::memory_order_acquire) >= Capacity)
+    {
+      overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    items[currentHead & (Capacity - 1)] = item;
+    head.store(currentHead + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, main task only.
+  bool pop(T &item)
+  {
+    const uint32_t currentTail = tail.load(std::memory_order_relaxed);
+    if (currentTail == head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    item = items[currentTail & (Capacity - 1)];
+    tail.store(currentTail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+  uint32_t overflowCount() const { return overflows.load(std::memory_order_relaxed); }
+
+private:
+  T items[Capacity];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> overflows{0};
+};
+
+#endif
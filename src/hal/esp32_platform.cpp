@@ -0,0 +1,105 @@
+#ifdef ARDUINO
+
+#include "hal.h"
+#include <sys/time.h>
+#include <driver/pcnt.h>
+
+int64_t hal::epochMillis()
+{
+  return epochMicros() / 1000;
+}
+
+int64_t hal::epochMicros()
+{
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+size_t hal::heapInUse()
+{
+  return ESP.getHeapSize() - ESP.getFreeHeap();
+}
+
+// The hardware counter is 16 bits. It is cleared on reaching the high
+// limit, and the interrupt for that counts the wraps.
+static const int16_t PULSE_COUNTER_LIMIT = 32767;
+static const uint32_t APB_CYCLES_PER_MICROSECOND = 80;
+static const uint16_t MAX_FILTER_CYCLES = 1023;
+static volatile uint32_t pulseCounterWraps[hal::PULSE_COUNTER_UNITS] = {};
+
+static void IRAM_ATTR onPulseCounterLimit(void *unit)
+{
+  pulseCounterWraps[(uintptr_t)unit]++;
+}
+
+bool hal::pulseCounterBegin(uint8_t unit, uint8_t pin, uint32_t filterNanos)
+{
+  if (unit >= PULSE_COUNTER_UNITS)
+  {
+    return false;
+  }
+
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = pin;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = (pcnt_unit_t)unit;
+  config.pos_mode = PCNT_COUNT_DIS;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = PULSE_COUNTER_LIMIT;
+  config.counter_l_lim = -1;
+  if (pcnt_unit_config(&config) != ESP_OK)
+  {
+    return false;
+  }
+
+  uint32_t filterCycles = filterNanos * APB_CYCLES_PER_MICROSECOND / 1000;
+  pcnt_set_filter_value(config.unit, filterCycles < MAX_FILTER_CYCLES ? filterCycles : MAX_FILTER_CYCLES);
+  if (filterCycles > 0)
+  {
+    pcnt_filter_enable(config.unit);
+  }
+  else
+  {
+    pcnt_filter_disable(config.unit);
+  }
+
+  // Only the high limit interrupts; the service may already be installed
+  // for another unit
+  pcnt_event_disable(config.unit, PCNT_EVT_ZERO);
+  pcnt_event_disable(config.unit, PCNT_EVT_L_LIM);
+  pcnt_event_disable(config.unit, PCNT_EVT_THRES_0);
+  pcnt_event_disable(config.unit, PCNT_EVT_THRES_1);
+  pcnt_event_enable(config.unit, PCNT_EVT_H_LIM);
+  esp_err_t installed = pcnt_isr_service_install(0);
+  if (installed != ESP_OK && installed != ESP_ERR_INVALID_STATE)
+  {
+    return false;
+  }
+  pcnt_isr_handler_add(config.unit, onPulseCounterLimit, (void *)(uintptr_t)unit);
+
+  pulseCounterWraps[unit] = 0;
+  pcnt_counter_pause(config.unit);
+  pcnt_counter_clear(config.unit);
+  pcnt_counter_resume(config.unit);
+  return true;
+}
+
+uint32_t hal::pulseCounterRead(uint8_t unit)
+{
+  // A wrap between the two reads would pair an old wrap count with the
+  // cleared counter, so read again until the wrap count holds still
+  uint32_t wraps;
+  int16_t value;
+  do
+  {
+    wraps = pulseCounterWraps[unit];
+    pcnt_get_counter_value((pcnt_unit_t)unit, &value);
+  } while (wraps != pulseCounterWraps[unit]);
+  return wraps * (uint32_t)PULSE_COUNTER_LIMIT + (uint16_t)value;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The pipeline modules include this instead of the Arduino headers. On the
+// ESP32 it is the real Arduino core, FS and ESPAsyncWebServer; on the host
+// (env:native) it is host_platform.h, which implements the same subset on
+// a virtual clock, simulated pins, a temp directory and loopback sockets.
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <FS.h>
+#include <ESPAsyncWebServer.h>
+#include <esp_timer.h>
+#else
+#include "host_platform.h"
+#endif
+
+namespace hal
+{
+  // Wall-clock time since the epoch
+  int64_t epochMillis();
+  int64_t epochMicros();
+
+  // Heap bytes allocated: on the ESP32 the heap's size less what is free,
+  // on the host what operator new holds
+  size_t heapInUse();
+
+  // Microseconds since boot from a 64-bit timer that never wraps or steps.
+  // Safe in an ISR: on the ESP32 it is esp_timer_get_time(), which lives in
+  // IRAM, and it is forced inline so no flash code runs on the way.
+  static inline __attribute__((always_inline)) int64_t monotonicMicros()
+  {
+#ifdef ARDUINO
+    return esp_timer_get_time();
+#else
+    return (int64_t)micros();
+#endif
+  }
+
+  // Hardware pulse counter (the ESP32 PCNT peripheral). A unit counts the
+  // falling edges on a pin with the pull-up on, ignoring pulses shorter
+  // than filterNanos; the filter tops out at 1023 APB cycles, about 12.8 us.
+  // The count wraps at 2^32, so differences of two reads are exact.
+  const uint8_t PULSE_COUNTER_UNITS = 8;
+  bool pulseCounterBegin(uint8_t unit, uint8_t pin, uint32_t filterNanos);
+  uint32_t pulseCounterRead(uint8_t unit);
+}
+
+#endif
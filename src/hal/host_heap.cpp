@@ -0,0 +1,75 @@
+#ifndef ARDUINO
+
+#include "hal.h"
+#include <atomic>
+#include <malloc.h>
+#include <new>
+#include <stdlib.h>
+
+// Heap, counted by replacing the global operator new. Blocks are counted
+// at the size malloc gave them, which free() finds again without a header,
+// so the array, sized and aligned forms from the library still pair up.
+// Atomic, as ring stress allocates from its threads. In a file of its own
+// so the compiler never sees a block from new reach free() inline.
+
+static std::atomic<size_t> heapBytes(0);
+static std::atomic<size_t> heapPeak(0);
+static std::atomic<size_t> heapAllocations(0);
+
+void *operator new(size_t size)
+{
+  void *block = malloc(size ? size : 1);
+  if (!block)
+  {
+    throw std::bad_alloc();
+  }
+  heapAllocations++;
+  size_t inUse = heapBytes += malloc_usable_size(block);
+  size_t peak = heapPeak.load();
+  while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse))
+  {
+  }
+  return block;
+}
+
+void operator delete(void *pointer) noexcept
+{
+  if (!pointer)
+  {
+    return;
+  }
+  heapBytes -= malloc_usable_size(pointer);
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  operator delete(pointer);
+}
+
+size_t hal::heapInUse()
+{
+  return heapBytes;
+}
+
+size_t hal::host::heapInUse()
+{
+  return heapBytes;
+}
+
+size_t hal::host::heapHighWater()
+{
+  return heapPeak;
+}
+
+size_t hal::host::heapAllocationCount()
+{
+  return heapAllocations;
+}
+
+void hal::host::resetHeapHighWater()
+{
+  heapPeak = heapBytes.load();
+}
+
+#endif
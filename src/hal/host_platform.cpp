@@ -0,0 +1,559 @@
+#ifndef ARDUINO
+
+#include "hal.h"
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Clock
+
+static const std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+static bool realTimeEnabled = true;
+// Skipped time, and while real time is off, the real time it had counted
+static int64_t clockOffset = 0;
+static int64_t epochMicrosAtStart = 1700000000000000LL;
+
+static int64_t realMicros()
+{
+  auto elapsed = std::chrono::steady_clock::now() - clockStart;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+unsigned long micros()
+{
+  return (realTimeEnabled ? realMicros() : 0) + clockOffset;
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  clockOffset += (int64_t)ms * 1000;
+}
+
+void yield()
+{
+}
+
+void hal::host::advanceClock(unsigned long microseconds)
+{
+  clockOffset += microseconds;
+}
+
+void hal::host::setRealTimeEnabled(bool enabled)
+{
+  if (enabled == realTimeEnabled)
+  {
+    return;
+  }
+  // Carry on from the current reading either way
+  int64_t now = micros();
+  realTimeEnabled = enabled;
+  clockOffset = now - (enabled ? realMicros() : 0);
+}
+
+void hal::host::setEpochMillisAtStart(int64_t epochMillis)
+{
+  epochMicrosAtStart = epochMillis * 1000;
+}
+
+void hal::host::setEpochMicros(int64_t epochMicros)
+{
+  epochMicrosAtStart = epochMicros - (int64_t)micros();
+}
+
+int64_t hal::epochMillis()
+{
+  return epochMicros() / 1000;
+}
+
+int64_t hal::epochMicros()
+{
+  return epochMicrosAtStart + (int64_t)micros();
+}
+
+// Pins
+
+struct SimulatedPin
+{
+  int level;
+  int mode;
+  void (*handler)();
+};
+
+static SimulatedPin pins[64] = {};
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  pins[pin].level = mode == INPUT_PULLUP ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pins[pin].level;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode)
+{
+  pins[pin].handler = handler;
+  pins[pin].mode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  pins[pin].handler = nullptr;
+}
+
+// Pulse counter units. Like the hardware filter, a level only counts once
+// it has held for the filter time, which is checked lazily on the next
+// change or read.
+struct SimulatedPulseCounter
+{
+  bool active;
+  uint8_t pin;
+  uint32_t filterNanos;
+  int rawLevel;
+  unsigned long rawSince;
+  int filteredLevel;
+  uint32_t count;
+};
+
+static SimulatedPulseCounter pulseCounters[hal::PULSE_COUNTER_UNITS] = {};
+
+static void settlePulseCounter(SimulatedPulseCounter &unit)
+{
+  if (unit.rawLevel == unit.filteredLevel ||
+      (uint64_t)(micros() - unit.rawSince) * 1000 < unit.filterNanos)
+  {
+    return;
+  }
+  if (unit.filteredLevel == HIGH && unit.rawLevel == LOW)
+  {
+    unit.count++;
+  }
+  unit.filteredLevel = unit.rawLevel;
+}
+
+bool hal::pulseCounterBegin(uint8_t unit, uint8_t pin, uint32_t filterNanos)
+{
+  if (unit >= PULSE_COUNTER_UNITS)
+  {
+    return false;
+  }
+  // The driver turns the pull-up on
+  pins[pin].level = HIGH;
+  pulseCounters[unit] = {true, pin, filterNanos, HIGH, micros(), HIGH, 0};
+  return true;
+}
+
+uint32_t hal::pulseCounterRead(uint8_t unit)
+{
+  settlePulseCounter(pulseCounters[unit]);
+  return pulseCounters[unit].count;
+}
+
+void hal::host::setPin(uint8_t pin, int level)
+{
+  SimulatedPin &simulated = pins[pin];
+  int previous = simulated.level;
+  simulated.level = level;
+  for (SimulatedPulseCounter &unit : pulseCounters)
+  {
+    if (unit.active && unit.pin == pin && unit.rawLevel != level)
+    {
+      settlePulseCounter(unit);
+      unit.rawLevel = level;
+      unit.rawSince = micros();
+    }
+  }
+  if (!simulated.handler || previous == level)
+  {
+    return;
+  }
+  if (simulated.mode == CHANGE ||
+      (simulated.mode == FALLING && level == LOW) ||
+      (simulated.mode == RISING && level == HIGH))
+  {
+    simulated.handler();
+  }
+}
+
+// Serial
+
+HostSerial Serial;
+static bool serialEnabled = true;
+
+void hal::host::setSerialEnabled(bool enabled)
+{
+  serialEnabled = enabled;
+}
+
+size_t HostSerial::printf(const char *format, ...)
+{
+  if (!serialEnabled)
+  {
+    return 0;
+  }
+  va_list args;
+  va_start(args, format);
+  int length = vprintf(format, args);
+  va_end(args);
+  return length < 0 ? 0 : length;
+}
+
+size_t HostSerial::print(const char *text)
+{
+  if (!serialEnabled)
+  {
+    return 0;
+  }
+  fputs(text, stdout);
+  return strlen(text);
+}
+
+size_t HostSerial::println(const char *text)
+{
+  return serialEnabled ? printf("%s\n", text) : 0;
+}
+
+// Filesystem
+
+struct fs::File::Handle
+{
+  std::string name;
+  FILE *stream = nullptr;
+  DIR *directory = nullptr;
+  std::string hostPath;
+
+  ~Handle()
+  {
+    if (stream)
+    {
+      fclose(stream);
+    }
+    if (directory)
+    {
+      closedir(directory);
+    }
+  }
+};
+
+size_t fs::File::write(const uint8_t *data, size_t length)
+{
+  return handle && handle->stream ? fwrite(data, 1, length, handle->stream) : 0;
+}
+
+size_t fs::File::read(uint8_t *data, size_t length)
+{
+  return handle && handle->stream ? fread(data, 1, length, handle->stream) : 0;
+}
+
+int fs::File::available()
+{
+  return handle && handle->stream ? (int)(size() - position()) : 0;
+}
+
+size_t fs::File::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length)
+  {
+    int c = handle && handle->stream ? fgetc(handle->stream) : EOF;
+    if (c == EOF || c == terminator)
+    {
+      break;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+bool fs::File::seek(uint32_t position)
+{
+  return handle && handle->stream && fseek(handle->stream, position, SEEK_SET) == 0;
+}
+
+size_t fs::File::position() const
+{
+  return handle && handle->stream ? ftell(handle->stream) : 0;
+}
+
+size_t fs::File::size() const
+{
+  if (!handle || !handle->stream)
+  {
+    return 0;
+  }
+  fflush(handle->stream);
+  struct stat info;
+  return fstat(fileno(handle->stream), &info) == 0 ? info.st_size : 0;
+}
+
+void fs::File::flush()
+{
+  if (handle && handle->stream)
+  {
+    fflush(handle->stream);
+  }
+}
+
+void fs::File::close()
+{
+  handle.reset();
+}
+
+const char *fs::File::name() const
+{
+  return handle ? handle->name.c_str() : "";
+}
+
+bool fs::File::isDirectory() const
+{
+  return handle && handle->directory;
+}
+
+fs::File fs::File::openNextFile()
+{
+  File next;
+  if (!isDirectory())
+  {
+    return next;
+  }
+
+  while (struct dirent *entry = readdir(handle->directory))
+  {
+    std::string path = handle->hostPath + "/" + entry->d_name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+      continue;
+    }
+    next.handle = std::make_shared<Handle>();
+    next.handle->name = handle->name + "/" + entry->d_name;
+    next.handle->hostPath = path;
+    next.handle->stream = fopen(path.c_str(), "rb");
+    break;
+  }
+  return next;
+}
+
+fs::FS::FS(const std::string &root) : root(root)
+{
+}
+
+std::string fs::FS::hostPath(const char *path) const
+{
+  return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+static void makeParentDirectories(const std::string &path)
+{
+  for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+  {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+  }
+}
+
+fs::File fs::FS::open(const char *path, const char *mode)
+{
+  File file;
+  std::string host = hostPath(path);
+
+  struct stat info;
+  if (strcmp(mode, FILE_READ) == 0 && stat(host.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+  {
+    file.handle = std::make_shared<File::Handle>();
+    file.handle->name = path;
+    file.handle->hostPath = host;
+    file.handle->directory = opendir(host.c_str());
+    return file;
+  }
+
+  const char *hostMode = strcmp(mode, FILE_WRITE) == 0    ? "wb+"
+                         : strcmp(mode, FILE_APPEND) == 0 ? "ab+"
+                         : strcmp(mode, "r+") == 0        ? "rb+"
+                                                          : "rb";
+  if (strcmp(mode, FILE_READ) != 0)
+  {
+    makeParentDirectories(host);
+  }
+  FILE *stream = fopen(host.c_str(), hostMode);
+  if (!stream)
+  {
+    return file;
+  }
+  file.handle = std::make_shared<File::Handle>();
+  file.handle->name = path;
+  file.handle->hostPath = host;
+  file.handle->stream = stream;
+  return file;
+}
+
+bool fs::FS::exists(const char *path)
+{
+  struct stat info;
+  return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool fs::FS::remove(const char *path)
+{
+  return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool fs::FS::rename(const char *from, const char *to)
+{
+  std::string target = hostPath(to);
+  makeParentDirectories(target);
+  return ::rename(hostPath(from).c_str(), target.c_str()) == 0;
+}
+
+std::string hal::host::makeTempDirectory(const char *prefix)
+{
+  const char *tmp = getenv("TMPDIR");
+  std::string path = std::string(tmp ? tmp : "/tmp") + "/" + prefix + "XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  return mkdtemp(name.data()) ? std::string(name.data()) : std::string();
+}
+
+void hal::host::removeDirectory(const std::string &path)
+{
+  DIR *directory = opendir(path.c_str());
+  if (!directory)
+  {
+    return;
+  }
+  while (struct dirent *entry = readdir(directory))
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+    {
+      continue;
+    }
+    std::string child = path + "/" + entry->d_name;
+    struct stat info;
+    if (stat(child.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+    {
+      removeDirectory(child);
+    }
+    else
+    {
+      unlink(child.c_str());
+    }
+  }
+  closedir(directory);
+  rmdir(path.c_str());
+}
+
+// Loopback WebSocket
+
+bool AsyncWebSocketClient::text(const char *message, size_t length)
+{
+  return text(std::make_shared<std::vector<uint8_t>>((const uint8_t *)message, (const uint8_t *)message + length));
+}
+
+bool AsyncWebSocketClient::text(AsyncWebSocketSharedBuffer buffer)
+{
+  return queueFrame(buffer, false);
+}
+
+bool AsyncWebSocketClient::binary(const uint8_t *message, size_t length)
+{
+  return binary(std::make_shared<std::vector<uint8_t>>(message, message + length));
+}
+
+bool AsyncWebSocketClient::binary(AsyncWebSocketSharedBuffer buffer)
+{
+  return queueFrame(buffer, true);
+}
+
+bool AsyncWebSocketClient::queueFrame(AsyncWebSocketSharedBuffer buffer, bool binary)
+{
+  if (!canSend())
+  {
+    framesDropped++;
+    return false;
+  }
+  queue.push_back({buffer, binary});
+  return true;
+}
+
+AsyncWebSocketClient *AsyncWebSocket::client(uint32_t id)
+{
+  for (AsyncWebSocketClient &client : clients)
+  {
+    if (client.id() == id)
+    {
+      return &client;
+    }
+  }
+  return nullptr;
+}
+
+bool AsyncWebSocket::textAll(const char *message, size_t length)
+{
+  return textAll(std::make_shared<std::vector<uint8_t>>((const uint8_t *)message, (const uint8_t *)message + length));
+}
+
+bool AsyncWebSocket::textAll(AsyncWebSocketSharedBuffer buffer)
+{
+  for (AsyncWebSocketClient &client : clients)
+  {
+    client.text(buffer);
+  }
+  return true;
+}
+
+AsyncWebSocketClient &AsyncWebSocket::connect()
+{
+  clients.emplace_back(nextClientId++);
+  return clients.back();
+}
+
+void AsyncWebSocket::disconnect(uint32_t id)
+{
+  clients.remove_if([id](const AsyncWebSocketClient &client)
+                    { return client.clientId == id; });
+}
+
+size_t AsyncWebSocket::drain()
+{
+  size_t delivered = 0;
+  for (AsyncWebSocketClient &client : clients)
+  {
+    delivered += deliver(client, SIZE_MAX);
+  }
+  return delivered;
+}
+
+size_t AsyncWebSocket::drain(uint32_t id, size_t maxFrames)
+{
+  AsyncWebSocketClient *target = client(id);
+  return target ? deliver(*target, maxFrames) : 0;
+}
+
+size_t AsyncWebSocket::deliver(AsyncWebSocketClient &client, size_t maxFrames)
+{
+  size_t delivered = 0;
+  while (delivered < maxFrames && !client.queue.empty())
+  {
+    AsyncWebSocketClient::Frame frame = client.queue.front();
+    client.queue.pop_front();
+    client.framesReceived++;
+    client.bytesReceived += frame.buffer->size();
+    if (sink)
+    {
+      sink(client, frame.buffer->data(), frame.buffer->size(), frame.binary);
+    }
+    delivered++;
+  }
+  return delivered;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+// Host stand-ins for the part of the Arduino core, FS and ESPAsyncWebServer
+// that the pipeline modules use. Only built for env:native, see hal.h.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef unsigned long ulong;
+
+#define IRAM_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+// Virtual clock: real time since start plus whatever advanceClock() and
+// delay() skipped, so measured durations stay real while idle time is free.
+// With real time turned off only the skips move it and runs repeat exactly.
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// Simulated pins, driven by hal::host::setPin()
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void detachInterrupt(uint8_t pin);
+
+class HostSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *text);
+  size_t println(const char *text = "");
+};
+
+extern HostSerial Serial;
+
+// Filesystem rooted in a host directory. Like SPIFFS, directories need not
+// be created before files are written into them.
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+  class FS;
+
+  class File
+  {
+  public:
+    size_t write(const uint8_t *data, size_t length);
+    size_t read(uint8_t *data, size_t length);
+    int available();
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+    bool seek(uint32_t position);
+    size_t position() const;
+    size_t size() const;
+    void flush();
+    void close();
+    const char *name() const;
+    bool isDirectory() const;
+    File openNextFile();
+    operator bool() const { return handle != nullptr; }
+
+  private:
+    friend class FS;
+    struct Handle;
+    std::shared_ptr<Handle> handle;
+  };
+
+  class FS
+  {
+  public:
+    explicit FS(const std::string &root);
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+
+  private:
+    std::string hostPath(const char *path) const;
+
+    std::string root;
+  };
+}
+
+using fs::File;
+
+// Loopback WebSocket. Frames wait in the client's queue until drain()
+// hands them to the sink, which stands in for the network task.
+typedef std::shared_ptr<std::vector<uint8_t>> AsyncWebSocketSharedBuffer;
+
+class AsyncWebSocketClient
+{
+public:
+  // Same limit as the library's WS_MAX_QUEUED_MESSAGES
+  static const size_t MAX_QUEUED_MESSAGES = 32;
+
+  explicit AsyncWebSocketClient(uint32_t id) : clientId(id) {}
+
+  uint32_t id() const { return clientId; }
+  bool canSend() const { return queue.size() < MAX_QUEUED_MESSAGES; }
+  size_t queueLen() const { return queue.size(); }
+  // Copies the message into a buffer of its own
+  bool text(const char *message, size_t length);
+  bool text(AsyncWebSocketSharedBuffer buffer);
+  bool binary(const uint8_t *message, size_t length);
+  bool binary(AsyncWebSocketSharedBuffer buffer);
+
+  // Loopback side
+  size_t framesReceived = 0;
+  size_t bytesReceived = 0;
+  size_t framesDropped = 0;
+
+private:
+  friend class AsyncWebSocket;
+
+  struct Frame
+  {
+    AsyncWebSocketSharedBuffer buffer;
+    bool binary;
+  };
+
+  bool queueFrame(AsyncWebSocketSharedBuffer buffer, bool binary);
+
+  uint32_t clientId;
+  std::deque<Frame> queue;
+};
+
+class AsyncWebSocket
+{
+public:
+  typedef std::function<void(AsyncWebSocketClient &client, const uint8_t *data, size_t length, bool binary)> Sink;
+
+  explicit AsyncWebSocket(const char *url) {}
+
+  AsyncWebSocketClient *client(uint32_t id);
+  size_t count() const { return clients.size(); }
+  std::list<AsyncWebSocketClient> &getClients() { return clients; }
+  bool textAll(const char *message, size_t length);
+  bool textAll(AsyncWebSocketSharedBuffer buffer);
+  void cleanupClients(uint16_t maxClients = 8) {}
+
+  // Loopback side
+  AsyncWebSocketClient &connect();
+  void disconnect(uint32_t id);
+  void setSink(Sink sink) { this->sink = sink; }
+  // Delivers every queued frame to the sink, returns how many
+  size_t drain();
+  // Delivers at most maxFrames of one client's queue, for a slow reader
+  size_t drain(uint32_t id, size_t maxFrames);
+
+private:
+  size_t deliver(AsyncWebSocketClient &client, size_t maxFrames);
+
+  std::list<AsyncWebSocketClient> clients;
+  uint32_t nextClientId = 1;
+  Sink sink;
+};
+
+namespace hal
+{
+  namespace host
+  {
+    // Moves the clock forward without waiting
+    void advanceClock(unsigned long microseconds);
+    void setRealTimeEnabled(bool enabled);
+    // Wall-clock time at millis() == 0; 0 for a clock that was never set
+    void setEpochMillisAtStart(int64_t epochMillis);
+    // Steps the wall clock to epochMicros now, as the first NTP answer does on the device
+    void setEpochMicros(int64_t epochMicros);
+    // Drives a simulated pin; an edge matching attachInterrupt() runs the
+    // handler, and pulse counter units on the pin see it through their filter
+    void setPin(uint8_t pin, int level);
+    void setSerialEnabled(bool enabled);
+    // Bytes held through operator new, now and at the most
+    size_t heapInUse();
+    size_t heapHighWater();
+    // Calls to operator new since the start
+    size_t heapAllocationCount();
+    void resetHeapHighWater();
+    // Empty directory under the system temp dir, to root an fs::FS in
+    std::string makeTempDirectory(const char *prefix);
+    void removeDirectory(const std::string &path);
+  }
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include "history_replay.h"
+#include "event_codec.h"
+
+HistoryReplay::HistoryReplay(AsyncWebSocket &ws, SegmentedLog &log, LogWriter &writer)
+    : ws(ws), log(log), writer(writer)
+{
+  for (size_t i = 0; i < MAX_CLIENTS; i++)
+  {
+    sessions[i].used = false;
+    sessions[i].replaying = false;
+    sessions[i].binary = false;
+    sessions[i].cursor.attach(log);
+  }
+}
+
+void HistoryReplay::clientConnected(uint32_t clientId, bool binary)
+{
+  if (!clientEvents.push({clientId, ClientEventType::Connected, 0, binary}))
+  {
+    Serial.println("Replay event queue full, client gets no history");
+  }
+}
+
+void HistoryReplay::clientConnected(uint32_t clientId, bool binary, uint32_t since)
+{
+  if (!clientEvents.push({clientId, ClientEventType::ConnectedSince, since, binary}))
+  {
+    Serial.println("Replay event queue full, client gets no history");
+  }
+}
+
+void HistoryReplay::clientDisconnected(uint32_t clientId)
+{
+  clientEvents.push({clientId, ClientEventType::Disconnected, 0, false});
+}
+
+void HistoryReplay::clientRequestedSince(uint32_t clientId, uint32_t sequence)
+{
+  clientEvents.push({clientId, ClientEventType::Since, sequence, false});
+}
+
+void HistoryReplay::pump()
+{
+  ClientEvent event;
+  while (clientEvents.pop(event))
+  {
+    switch (event.type)
+    {
+    case ClientEventType::Connected:
+      startSession(event.clientId, event.binary);
+      break;
+    case ClientEventType::ConnectedSince:
+      startSession(event.clientId, event.binary);
+      resumeSession(event.clientId, event.sequence);
+      break;
+    case ClientEventType::Since:
+      resumeSession(event.clientId, event.sequence);
+      break;
+    case ClientEventType::Disconnected:
+      if (Session *session = findSession(event.clientId))
+      {
+        releaseSession(*session);
+      }
+      break;
+    }
+  }
+
+  if (replaying == 0)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < MAX_CLIENTS; i++)
+  {
+    Session &session = sessions[i];
+    if (!session.used || !session.replaying)
+    {
+      continue;
+    }
+
+    AsyncWebSocketClient *client = ws.client(session.clientId);
+    if (!client)
+    {
+      releaseSession(session);
+      continue;
+    }
+
+    for (size_t chunk = 0; chunk < CHUNKS_PER_PASS && session.replaying; chunk++)
+    {
+      if (!client->canSend() || client->queueLen() >= MAX_QUEUED_MESSAGES)
+      {
+        break;
+      }
+      if (!sendChunk(session, client))
+      {
+        // Caught up with what is on flash. Anything still buffered goes to
+        // flash first, otherwise this client would never see it.
+        if (writer.buffered() > 0)
+        {
+          writer.sync();
+          continue;
+        }
+        Serial.printf("Replay to client %lu done, %u bytes\n",
+                      (unsigned long)session.clientId, (unsigned)session.bytesSent);
+        endReplay(session);
+      }
+    }
+  }
+}
+
+void HistoryReplay::broadcast(const AsyncWebSocketSharedBuffer &frame)
+{
+  if (replaying == 0)
+  {
+    ws.textAll(frame);
+    return;
+  }
+
+  // Clients without a session, past MAX_CLIENTS or whose connect was
+  // lost, get it too
+  for (AsyncWebSocketClient &client : ws.getClients())
+  {
+    Session *session = findSession(client.id());
+    if (!session || !session->replaying)
+    {
+      client.text(frame);
+    }
+  }
+}
+
+void HistoryReplay::broadcastEvents(const AsyncWebSocketSharedBuffer &json, const AsyncWebSocketSharedBuffer &binary)
+{
+  if (binarySessions == 0)
+  {
+    if (json)
+    {
+      broadcast(json);
+    }
+    return;
+  }
+
+  // Clients without a session, past MAX_CLIENTS, get JSON
+  for (AsyncWebSocketClient &client : ws.getClients())
+  {
+    Session *session = findSession(client.id());
+    if (session && session->replaying)
+    {
+      continue;
+    }
+    if (session && session->binary)
+    {
+      if (binary)
+      {
+        client.binary(binary);
+      }
+    }
+    else if (json)
+    {
+      client.text(json);
+    }
+  }
+}
+
+void HistoryReplay::cancelAll()
+{
+  for (size_t i = 0; i < MAX_CLIENTS; i++)
+  {
+    endReplay(sessions[i]);
+  }
+}
+
+void HistoryReplay::startSession(uint32_t clientId, bool binary)
+{
+  Session *session = findSession(clientId);
+  for (size_t i = 0; !session && i < MAX_CLIENTS; i++)
+  {
+    if (!sessions[i].used)
+    {
+      session = &sessions[i];
+    }
+  }
+  if (!session)
+  {
+    Serial.println("Too many clients, no history replay");
+    return;
+  }
+
+  if (session->used && session->binary)
+  {
+    binarySessions--;
+  }
+  session->clientId = clientId;
+  session->used = true;
+  session->binary = binary;
+  binarySessions += binary ? 1 : 0;
+  session->bytesSent = 0;
+  if (!session->replaying)
+  {
+    session->replaying = true;
+    replaying++;
+  }
+
+  session->cursor.seekSegment(replayStartPosition());
+}
+
+void HistoryReplay::resumeSession(uint32_t clientId, uint32_t sequence)
+{
+  Session *session = findSession(clientId);
+  if (!session)
+  {
+    return;
+  }
+
+  if (!session->replaying)
+  {
+    session->replaying = true;
+    replaying++;
+  }
+
+  // The client has everything up to sequence, so start right after it
+  // unless that is further back than a full replay would go
+  if (log.findSequence(sequence + 1) < replayStartPosition())
+  {
+    session->cursor.seekSegment(replayStartPosition());
+  }
+  else
+  {
+    session->cursor.seekSequence(sequence + 1);
+  }
+}
+
+size_t HistoryReplay::replayStartPosition() const
+{
+  // Only the newest segments, about MAX_REPLAY_LOG_BYTES of the log
+  size_t segments = MAX_REPLAY_LOG_BYTES / log.maxSegmentSize();
+  size_t total = log.segmentCount();
+  return total > segments ? total - segments : 0;
+}
+
+HistoryReplay::Session *HistoryReplay::findSession(uint32_t clientId)
+{
+  for (size_t i = 0; i < MAX_CLIENTS; i++)
+  {
+    if (sessions[i].used && sessions[i].clientId == clientId)
+    {
+      return &sessions[i];
+    }
+  }
+  return nullptr;
+}
+
+void HistoryReplay::endReplay(Session &session)
+{
+  session.cursor.close();
+  if (session.replaying)
+  {
+    session.replaying = false;
+    replaying--;
+  }
+}
+
+void HistoryReplay::releaseSession(Session &session)
+{
+  endReplay(session);
+  if (session.used && session.binary)
+  {
+    binarySessions--;
+  }
+  session.used = false;
+  session.binary = false;
+}
+
+bool HistoryReplay::sendChunk(Session &session, AsyncWebSocketClient *client)
+{
+  // Large enough for either format, binary records being the smaller
+  static EventRecord records[CHUNK_RECORDS];
+  static uint8_t frame[CHUNK_RECORDS * (EVENT_JSON_MAX_LENGTH + 1) + 2];
+
+  size_t count = 0;
+  while (count < CHUNK_RECORDS && session.cursor.next(records[count]))
+  {
+    count++;
+  }
+  if (count == 0)
+  {
+    return false;
+  }
+
+  size_t frameLength;
+  if (session.binary)
+  {
+    frameLength = encodeEventFrame(records, count, frame);
+    client->binary(frame, frameLength);
+  }
+  else
+  {
+    frameLength = encodeEventJsonArray(records, count, (char *)frame);
+    client->text((const char *)frame, frameLength);
+  }
+  session.bytesSent += frameLength;
+  return true;
+}
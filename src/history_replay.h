@@ -0,0 +1,101 @@
+#ifndef HISTORY_REPLAY_H
+#define HISTORY_REPLAY_H
+
+#include "hal/hal.h"
+#include "event_ring.h"
+#include "log_writer.h"
+#include "segmented_log.h"
+
+// Sends the logged history to newly connected WebSocket clients from the
+// persistence task, in chunks small enough that the client's queue never
+// overflows.
+// A replaying client gets no live frames; its cursor catches up with the
+// log instead, and live frames resume once it has. A client that connects
+// with ?since=N only gets the records after sequence N, from its first
+// chunk on; {"since":N} sent after connecting still works, but the replay
+// may have sent chunks of the full window by the time it is pumped.
+// Clients that negotiated EVENT_FRAME_PROTOCOL get records as binary
+// frames, history and live alike; everything else stays JSON text.
+class HistoryReplay
+{
+public:
+  static const size_t MAX_CLIENTS = 8;
+  // Records per JSON array or binary frame
+  static const size_t CHUNK_RECORDS = 32;
+  // Chunks are only sent while the client has fewer messages queued
+  static const size_t MAX_QUEUED_MESSAGES = 4;
+  static const size_t CHUNKS_PER_PASS = 2;
+  // Replay starts far enough back to read about this much of the log
+  static const size_t MAX_REPLAY_LOG_BYTES = 256 * 1024;
+
+  HistoryReplay(AsyncWebSocket &ws, SegmentedLog &log, LogWriter &writer);
+
+  // Called from the WebSocket event handler
+  void clientConnected(uint32_t clientId, bool binary = false);
+  // Connected asking for the records after sequence since
+  void clientConnected(uint32_t clientId, bool binary, uint32_t since);
+  void clientDisconnected(uint32_t clientId);
+  void clientRequestedSince(uint32_t clientId, uint32_t sequence);
+
+  // Called from the persistence task
+  void pump();
+  // Queues a live frame for every client that is not replaying. Every
+  // queue holds a reference to the same buffer, nothing is copied.
+  void broadcast(const AsyncWebSocketSharedBuffer &frame);
+  // Queues a batch of records for every client that is not replaying, the
+  // binary frame to binary clients and the JSON one to the rest. A frame
+  // nobody wants may be null; see binaryClients() and textClients().
+  void broadcastEvents(const AsyncWebSocketSharedBuffer &json, const AsyncWebSocketSharedBuffer &binary);
+  // Stops every replay, e.g. when the log is cleared
+  void cancelAll();
+  // Clients still being sent history
+  size_t activeReplays() const { return replaying; }
+  size_t binaryClients() const { return binarySessions; }
+  size_t textClients() const { return ws.count() > binarySessions ? ws.count() - binarySessions : 0; }
+
+private:
+  enum class ClientEventType : uint8_t
+  {
+    Connected,
+    ConnectedSince,
+    Disconnected,
+    Since
+  };
+
+  struct ClientEvent
+  {
+    uint32_t clientId;
+    ClientEventType type;
+    uint32_t sequence;
+    bool binary;
+  };
+
+  struct Session
+  {
+    uint32_t clientId;
+    bool used;
+    bool replaying;
+    bool binary;
+    size_t bytesSent;
+    LogCursor cursor;
+  };
+
+  void startSession(uint32_t clientId, bool binary);
+  void resumeSession(uint32_t clientId, uint32_t sequence);
+  size_t replayStartPosition() const;
+  Session *findSession(uint32_t clientId);
+  void endReplay(Session &session);
+  void releaseSession(Session &session);
+  bool sendChunk(Session &session, AsyncWebSocketClient *client);
+
+  AsyncWebSocket &ws;
+  SegmentedLog &log;
+  LogWriter &writer;
+  // Connects and disconnects arrive on the network task
+  EventRing<ClientEvent, 16> clientEvents;
+  Session sessions[MAX_CLIENTS];
+  size_t replaying = 0;
+  size_t binarySessions = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-linear histogram of latencies for percentiles without keeping
+// samples. Values below 16 get a bucket each, larger ones share 8 buckets
+// per power of two (12.5 % resolution) up to 2^20, about 17 minutes in
+// milliseconds or 1 s in microseconds. Adding a sample is O(1) and the
+// whole thing is under 600 bytes.
+class LatencyHistogram
+{
+public:
+  static const size_t LINEAR_BUCKETS = 16;
+  static const size_t SUB_BUCKETS = 8;
+  static const size_t BUCKETS = LINEAR_BUCKETS + (20 - 4) * SUB_BUCKETS;
+
+  void add(uint32_t valueMs)
+  {
+    buckets[bucketOf(valueMs)]++;
+    samples++;
+    if (valueMs > largest)
+    {
+      largest = valueMs;
+    }
+  }
+
+  // Upper bound of the bucket holding the given fraction of samples, but
+  // never above the largest sample; 0 when there are none
+  uint32_t percentile(float fraction) const
+  {
+    if (samples == 0)
+    {
+      return 0;
+    }
+    uint32_t wanted = (uint32_t)(fraction * samples + 0.5f);
+    wanted = wanted < 1 ? 1 : wanted;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if (seen >= wanted)
+      {
+        return upperBound(i) < largest ? upperBound(i) : largest;
+      }
+    }
+    return largest;
+  }
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return largest; }
+
+  void clear()
+  {
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+      buckets[i] = 0;
+    }
+    samples = 0;
+    largest = 0;
+  }
+
+private:
+  static size_t bucketOf(uint32_t value)
+  {
+    if (value < LINEAR_BUCKETS)
+    {
+      return value;
+    }
+    size_t exponent = 31 - __builtin_clz(value);
+    if (exponent >= 20)
+    {
+      return BUCKETS - 1;
+    }
+    size_t sub = (value >> (exponent - 3)) & (SUB_BUCKETS - 1);
+    return LINEAR_BUCKETS + (exponent - 4) * SUB_BUCKETS + sub;
+  }
+
+  static uint32_t upperBound(size_t bucket)
+  {
+    if (bucket < LINEAR_BUCKETS)
+    {
+      return bucket;
+    }
+    size_t exponent = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS + 4;
+    size_t sub = (bucket - LINEAR_BUCKETS) % SUB_BUCKETS;
+    return ((uint32_t)(SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+  }
+
+  uint32_t buckets[BUCKETS] = {};
+  uint32_t samples = 0;
+  uint32_t largest = 0;
+};
+
+#endif
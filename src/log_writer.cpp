@@ -0,0 +1,177 @@
+#include "log_writer.h"
+
+LogWriter::LogWriter(fs::FS &fs, const char *path, const EventLogFormat &format,
+                     FlushPolicy policy, unsigned long intervalMs)
+    : filesystem(fs), format(format), flushPolicy(policy), flushIntervalMs(intervalMs)
+{
+  snprintf(this->path, sizeof(this->path), "%s", path);
+}
+
+bool LogWriter::begin()
+{
+  if (file)
+  {
+    return true;
+  }
+
+  file = filesystem.open(path, FILE_APPEND);
+  if (!file)
+  {
+    Serial.println("Failed to open file for writing");
+    return false;
+  }
+  fileLength = file.size();
+
+  // Header for a new file, or realignment after a torn write
+  uint8_t prefix[EventLogFormat::MAX_ENCODED_SIZE];
+  size_t prefixLength = format.prepareAppend(fileLength, prefix);
+  if (prefixLength > 0)
+  {
+    return writeThrough(prefix, prefixLength);
+  }
+  return true;
+}
+
+void LogWriter::close()
+{
+  sync();
+  if (file)
+  {
+    file.close();
+  }
+}
+
+bool LogWriter::reopen(const char *newPath)
+{
+  close();
+  snprintf(path, sizeof(path), "%s", newPath);
+  return begin();
+}
+
+bool LogWriter::append(const EventRecord &record)
+{
+  uint8_t encoded[EventLogFormat::MAX_ENCODED_SIZE];
+  size_t length = format.encode(record, encoded);
+  return appendBytes(encoded, length);
+}
+
+bool LogWriter::appendBytes(const uint8_t *data, size_t length)
+{
+  writerStats.appends++;
+
+  if (bufferLength + length > BUFFER_SIZE && !sync())
+  {
+    return false;
+  }
+
+  if (length > BUFFER_SIZE)
+  {
+    // Too big to buffer, goes straight to flash
+    return writeThrough(data, length);
+  }
+
+  if (bufferLength == 0)
+  {
+    oldestBufferedAt = millis();
+  }
+  memcpy(buffer + bufferLength, data, length);
+  bufferLength += length;
+
+  if (flushPolicy == FlushPolicy::EveryRecord)
+  {
+    return sync();
+  }
+  return true;
+}
+
+void LogWriter::poll()
+{
+  if (flushPolicy == FlushPolicy::Interval && bufferLength > 0 &&
+      millis() - oldestBufferedAt >= flushIntervalMs)
+  {
+    sync();
+  }
+}
+
+unsigned long LogWriter::msUntilFlush() const
+{
+  if (flushPolicy != FlushPolicy::Interval || bufferLength == 0)
+  {
+    return ULONG_MAX;
+  }
+  unsigned long age = millis() - oldestBufferedAt;
+  return age < flushIntervalMs ? flushIntervalMs - age : 0;
+}
+
+bool LogWriter::sync()
+{
+  if (bufferLength == 0)
+  {
+    return true;
+  }
+
+  bool written = writeThrough(buffer, bufferLength);
+  bufferLength = 0;
+  return written;
+}
+
+void LogWriter::setPolicy(FlushPolicy policy, unsigned long intervalMs)
+{
+  flushPolicy = policy;
+  flushIntervalMs = intervalMs;
+  if (flushPolicy == FlushPolicy::EveryRecord)
+  {
+    sync();
+  }
+}
+
+unsigned long LogWriter::durabilityWindowMs() const
+{
+  switch (flushPolicy)
+  {
+  case FlushPolicy::EveryRecord:
+    return 0;
+  case FlushPolicy::Interval:
+    return flushIntervalMs;
+  default:
+    return ULONG_MAX;
+  }
+}
+
+uint32_t LogWriter::sustainableFlushesPerSecond() const
+{
+  if (writerStats.flushes == 0 || writerStats.totalFlushMicros == 0)
+  {
+    return 0;
+  }
+  return (uint32_t)(1000000ULL * writerStats.flushes / writerStats.totalFlushMicros);
+}
+
+bool LogWriter::writeThrough(const uint8_t *data, size_t length)
+{
+  if (!begin())
+  {
+    return false;
+  }
+
+  unsigned long startMicros = micros();
+  size_t written = file.write(data, length);
+  file.flush();
+  uint32_t elapsed = micros() - startMicros;
+
+  writerStats.flushes++;
+  writerStats.bytesWritten += written;
+  fileLength += written;
+  writerStats.totalFlushMicros += elapsed;
+  if (elapsed > writerStats.maxFlushMicros)
+  {
+    writerStats.maxFlushMicros = elapsed;
+  }
+
+  if (written != length)
+  {
+    Serial.println("Failed to write to file");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include "hal/hal.h"
+#include <limits.h>
+#include "event_log_format.h"
+#include "event_record.h"
+
+// When buffered log data is written through to flash
+enum class FlushPolicy
+{
+  EveryRecord, // Flush after every append
+  Interval,    // Flush once the oldest buffered byte is intervalMs old
+  BufferFull   // Flush only when the buffer cannot take the next append
+};
+
+struct LogWriterStats
+{
+  uint32_t appends;
+  uint32_t flushes;
+  uint32_t bytesWritten;
+  uint32_t totalFlushMicros;
+  uint32_t maxFlushMicros;
+};
+
+// Append-only log file that keeps its handle open and collects appends in
+// RAM, so the flash is touched once per flush instead of once per record.
+// Records are laid out by the EventLogFormat it is given.
+class LogWriter
+{
+public:
+  static const size_t BUFFER_SIZE = 2048;
+  static const size_t MAX_PATH_LENGTH = 32;
+
+  LogWriter(fs::FS &fs, const char *path, const EventLogFormat &format,
+            FlushPolicy policy, unsigned long intervalMs);
+
+  bool begin();
+  void close();
+  // Flushes, closes and continues in another file
+  bool reopen(const char *newPath);
+
+  bool append(const EventRecord &record);
+  // Flushes on age; call from the persistence task
+  void poll();
+  // How long poll() has nothing to do, ULONG_MAX until something is
+  // buffered under the Interval policy
+  unsigned long msUntilFlush() const;
+  // Writes everything buffered to flash now
+  bool sync();
+
+  void setPolicy(FlushPolicy policy, unsigned long intervalMs);
+  FlushPolicy policy() const { return flushPolicy; }
+  unsigned long interval() const { return flushIntervalMs; }
+
+  // Longest time appended data can sit in RAM before it reaches flash.
+  // ULONG_MAX when only a full buffer forces a flush.
+  unsigned long durabilityWindowMs() const;
+  // Most data lost if power fails right before a flush
+  size_t durabilityWindowBytes() const { return BUFFER_SIZE; }
+  // Flushes per second the flash sustains at the measured flush cost
+  uint32_t sustainableFlushesPerSecond() const;
+
+  size_t buffered() const { return bufferLength; }
+  // Bytes on flash, not counting what is still buffered
+  size_t size() const { return fileLength; }
+  const LogWriterStats &stats() const { return writerStats; }
+  void resetStats() { writerStats = {}; }
+
+private:
+  bool appendBytes(const uint8_t *data, size_t length);
+  bool writeThrough(const uint8_t *data, size_t length);
+
+  fs::FS &filesystem;
+  char path[MAX_PATH_LENGTH];
+  const EventLogFormat &format;
+  File file;
+  FlushPolicy flushPolicy;
+  unsigned long flushIntervalMs;
+  uint8_t buffer[BUFFER_SIZE];
+  size_t bufferLength = 0;
+  size_t fileLength = 0;
+  unsigned long oldestBufferedAt = 0;
+  LogWriterStats writerStats = {};
+};
+
+#endif
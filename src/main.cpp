@@ -6,206 +6,907 @@
 #include <AsyncTCP.h>
 #include <ArduinoJson.h>
 #include <time.h>
+#include <esp_sntp.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+#include <array>
+#include <utility>
 #include "config.h"
-#include <queue>
+#include "boot_timeline.h"
+#include "broadcast_benchmark.h"
+#include "clock_sync.h"
+#include "count_checkpoint.h"
+#include "event_record.h"
+#include "event_codec.h"
+#include "event_log_format.h"
+#include "log_writer.h"
+#include "segmented_log.h"
+#include "history_replay.h"
+#include "press_pipeline.h"
+#include "pulse_counter.h"
+#include "rate_engine.h"
+#include "rollup_store.h"
+#include "throughput_benchmark.h"
+#include <Preferences.h>
 
 // Constants
 const unsigned long RESET_HOLD_TIME = 5000;
 const char *NTP_SERVER = "pool.ntp.org";
-const long GMT_OFFSET_SEC = 3600; // GMT+1
-const int DAYLIGHT_OFFSET_SEC = 3600;
+// POSIX TZ, GMT+1 with European summer time
+const char *TIME_ZONE = "CET-1CEST,M3.5.0,M10.5.0/3";
+// SNTP asks again this often once it has an answer, and keeps retrying in
+// the background until then
+const uint32_t NTP_RESYNC_INTERVAL = 3600000;
+
+const unsigned long HEAP_REPORT_INTERVAL = 60000;
+// A direct connect to the cached access point normally takes well under a
+// second; past this it scans like a first boot
+const unsigned long WIFI_CACHED_TIMEOUT = 3000;
+const unsigned long WIFI_SCAN_TIMEOUT = 10000;
 
 // Globals
-std::queue<String> buttonLog;
+// Button log, kept open with appends buffered in RAM
+JsonLinesFormat jsonLinesFormat;
+BinaryLogFormat binaryLogFormat;
+const EventLogFormat &logFormat = config::UseBinaryLog ? (const EventLogFormat &)binaryLogFormat : jsonLinesFormat;
+const String &legacyLogPath = config::UseBinaryLog ? config::ButtonLogBinaryPath : config::ButtonLogPath;
+LogWriter logWriter(SPIFFS, legacyLogPath.c_str(), logFormat, FlushPolicy::Interval, 1000);
+
+// The log is rotated into 64 KB segments and the oldest are dropped once
+// the log passes 1 MB or one year
+const size_t LOG_SEGMENT_SIZE = 64 * 1024;
+const RetentionPolicy LOG_RETENTION = {1024 * 1024, 365UL * 24 * 3600};
+SegmentedLog buttonLogStore(SPIFFS, config::ButtonLogDirectory, logFormat, logWriter, LOG_SEGMENT_SIZE, LOG_RETENTION);
+volatile bool resetRequested = false;
+// Settings from POST /settings. Batching and the log writer belong to the
+// persistence task, so the handler only queues them here.
+struct PendingSettings
+{
+  size_t batchSize;
+  unsigned long batchWindow;
+  FlushPolicy flushPolicy;
+  unsigned long flushInterval;
+};
+PendingSettings pendingSettings;
+volatile bool settingsRequested = false;
+volatile bool broadcastBenchmarkRequested = false;
+volatile bool throughputBenchmarkRequested = false;
+
+// Count checkpoint in NVS: each channel's count at the last flushed record,
+// the segment and size at that point and the next sequence number. Boot
+// only scans the log past that offset.
+const unsigned long CHECKPOINT_INTERVAL = 60000;
+Preferences checkpointStore;
+ulong checkpointCounts[config::ChannelCount] = {};
+// Counts as restored at boot
+ulong bootCounts[config::ChannelCount] = {};
+// Clients see a record's sequence before the log is flushed, so a power
+// cut can lose records whose numbers are out. Boot never numbers below
+// the limit in NVS, which reserveSequences() keeps ahead of the pipeline.
+const uint32_t SEQUENCE_RESERVE_BLOCK = 1000;
+// Half a block of headroom covers every record one persistence pass can
+// number and emit, pending and held alike
+static_assert(PressPipeline::EVENT_POOL_CAPACITY + PressPipeline::HELD_CAPACITY < SEQUENCE_RESERVE_BLOCK / 2,
+              "Sequence reservation does not cover a persistence pass");
+uint32_t reservedSequences = 0;
+
+// The access point, channel and lease of the last connection, so the next
+// boot skips the scan and DHCP. Kept only for the SSID it was made with.
+struct WiFiCache
+{
+  char ssid[33];
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t leaseReuses; // Boots in a row the lease was reused
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+Preferences wifiStore;
+
+// How the boot got onto the network and how soon it served a request
+enum class WiFiPath : uint8_t
+{
+  Cached,
+  Scan,
+  Failed
+};
+WiFiPath wifiPath = WiFiPath::Failed;
+bool wifiLeaseReused = false;
+unsigned long wifiConnectMs = 0;
+// Set by the first request, from the async_tcp task
+volatile bool firstRequestServed = false;
+
+// Boot runs in stages: the interrupts first, so no pulse is missed, then
+// storage and the count restore in setup() while the network task brings
+// up WiFi and SNTP. The web server waits for storage, its handlers read the
+// log and the counts.
+BootTimeline bootTimeline;
+EventGroupHandle_t bootEvents = nullptr;
+const EventBits_t BOOT_STORAGE_READY = 1 << 0;
+// Phases ended from callbacks: SNTP's first answer and the first request
+size_t clockPhase = BootTimeline::MAX_PHASES;
+size_t firstRequestPhase = BootTimeline::MAX_PHASES;
 
 // Web Server
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
+HistoryReplay historyReplay(ws, buttonLogStore, logWriter);
+PressPipeline pressPipeline(buttonLogStore, historyReplay, config::ChannelCount);
+RateEngine rateEngine(config::ChannelCount);
+ClockSync clockSync;
+// Today's totals need the date, so they wait for the clock at boot
+volatile bool todayRestored = false;
+
+// Rollups keep 2 days of minutes, 90 days of hours and 3 years of days,
+// 8 bytes a bucket with one channel, about 50 KB together
+const RollupRetention ROLLUP_RETENTION = {2 * 24 * 60, 90 * 24, 3 * 366};
+// Most buckets one /rollups response holds; the rest is paged with "next"
+const size_t ROLLUP_MAX_BUCKETS = 500;
+RollupStore rollupStore(SPIFFS, config::RollupDirectory, config::ChannelCount, ROLLUP_RETENTION);
+// Pipeline tasks, see config::CaptureTask. The capture lock keeps a reset
+// or a rate snapshot from running in the middle of a capture pass.
+TaskHandle_t captureTaskHandle = nullptr;
+TaskHandle_t persistenceTaskHandle = nullptr;
+SemaphoreHandle_t captureLock = nullptr;
+// Guards pendingSettings between the network and persistence tasks
+SemaphoreHandle_t settingsLock = nullptr;
+// Times each task woke up, for the idle report
+volatile uint32_t captureWakeups = 0;
+volatile uint32_t persistenceWakeups = 0;
+
+// ws.cleanupClients() runs on a FreeRTOS timer instead of every pass
+const unsigned long CLIENT_CLEANUP_INTERVAL = 1000;
+TimerHandle_t clientCleanupTimer = nullptr;
 
-// Utility Functions
-void writeToFile(const String &filename, const String &data);
-String readFileContents(const String &filename);
+static_assert(config::ChannelCount > 0 && config::ChannelCount <= PressPipeline::MAX_CHANNELS,
+              "config::Channels needs 1 to PressPipeline::MAX_CHANNELS entries");
 
 // Initialization Functions
 void setupWebServer();
+void networkTask(void *parameter);
+void endBootPhase(size_t phase);
+const char *wifiPathName();
 void setupWiFi();
+bool waitForWiFi(unsigned long timeoutMs);
+bool loadWiFiCache(WiFiCache &cache);
+void saveWiFiCache(const WiFiCache &previous, bool cached);
 void setupNTP();
-bool waitForNTPSync(int maxAttempts = 10);
+void onTimeSync(struct timeval *ntpTime);
+void restoreTodayOnceClockSet();
+void startPipelineTasks();
+void captureTask(void *parameter);
+void persistenceTask(void *parameter);
+void wakePersistenceTask();
+void cleanupClients(TimerHandle_t timer);
 
 void handleRootRequest(AsyncWebServerRequest *request);
+void handleChannelsRequest(AsyncWebServerRequest *request);
+void handleRollupsRequest(AsyncWebServerRequest *request);
+void handleBootRequest(AsyncWebServerRequest *request);
 void handleWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
 void handleServiceModeRequest(AsyncWebServerRequest *request);
+void handleGetSettingsRequest(AsyncWebServerRequest *request);
+void handleSetSettingsRequest(AsyncWebServerRequest *request);
 
-// Structs
-struct Button
+// Channel Interrupt Functions
+// One ISR per channel in config::Channels, each with its channel number
+// compiled in, so a pulse costs no table lookup
+template <uint8_t CHANNEL>
+void IRAM_ATTR onChannelPulse()
 {
-  const uint8_t PIN;
-  ulong numberOfPresses;
-  bool isPressed;
-};
-
-// Button and Interrupt Functions
-Button button1 = {4, 0, false};
-volatile ulong currentInterruptTime = 0;
-volatile ulong previousInterruptTime = 0;
-const int DEBOUNCE_DELAY = 250;
+  // Bounces inside the debounce delay don't wake anybody
+  if (pressPipeline.onPulse(CHANNEL) && captureTaskHandle)
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(captureTaskHandle, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
 
-void IRAM_ATTR onButtonPress();
+template <size_t... CHANNELS>
+constexpr std::array<void (*)(), sizeof...(CHANNELS)> makeChannelIsrs(std::index_sequence<CHANNELS...>)
+{
+  return {{&onChannelPulse<CHANNELS>...}};
+}
 
-void handleOnButtonPress();
+const std::array<void (*)(), config::ChannelCount> channelIsrs =
+    makeChannelIsrs(std::make_index_sequence<config::ChannelCount>());
+// Set up at boot for channels on the PulseCounter backend
+PulseCounter *pulseCounters[config::ChannelCount] = {};
 
 // Core Functionality
-void processFifoBuffer();
+void reportHeapWatermark();
+void reportBatchStats();
+void reportTaskLatency();
+void reportClockSync();
+void reportBootMetrics();
+void pushRates();
+void pollRollups();
+void restoreTodayFromLog();
+void reportLogWriterStats();
+void runBroadcastBenchmark();
+void runThroughputBenchmark();
+void servicePipeline();
+void handleResetRequest();
+void applySettingsRequest();
+void saveCheckpoint();
+void reserveSequences();
+const char *flushPolicyName(FlushPolicy policy);
 
-unsigned long loadButtonCountFromFile();
+void loadButtonCountFromFile();
+void checkpointCountKey(uint8_t channel, char *key, size_t capacity);
 
 // Setup Function
 void setup()
 {
+  size_t setupPhase = bootTimeline.begin("setup");
   Serial.begin(115200);
+  bootEvents = xEventGroupCreate();
+  // Restore and rollups work in local days before SNTP starts, and after
+  // a soft reset the clock is already set
+  setenv("TZ", TIME_ZONE, 1);
+  tzset();
+
+  // Pulses queue up in the rings from here on and wait there for the
+  // capture task, which starts once the counts are restored
+  size_t phase = bootTimeline.begin("capture");
+  pressPipeline.setRateEngine(&rateEngine);
+  pressPipeline.setRollupStore(&rollupStore);
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    const ChannelConfig &input = config::Channels[channel];
+    rateEngine.setUnitsPerPulse(channel, input.unitsPerPulse);
+    if (input.backend == CaptureBackend::PulseCounter)
+    {
+      pulseCounters[channel] = new PulseCounter(pressPipeline, channel, input.pulseCounterUnit, input.pin);
+      if (pulseCounters[channel]->begin())
+      {
+        continue;
+      }
+      // Count on the pin interrupt instead of leaving the channel dead,
+      // and leave a mark in /boot
+      delete pulseCounters[channel];
+      pulseCounters[channel] = nullptr;
+      Serial.printf("Channel %u falls back to the pin interrupt\n", (unsigned)channel);
+      endBootPhase(bootTimeline.begin("pulse counter fallback"));
+    }
+    pressPipeline.setDebounce(channel, input.debounceMs);
+    pinMode(input.pin, INPUT_PULLUP);
+    attachInterrupt(input.pin, channelIsrs[channel], FALLING);
+  }
+  endBootPhase(phase);
+
+  xTaskCreatePinnedToCore(networkTask, config::NetworkTask.name, config::NetworkTask.stackBytes, nullptr,
+                          config::NetworkTask.priority, nullptr, config::NetworkTask.core);
+
+  phase = bootTimeline.begin("storage");
   SPIFFS.begin(true);
+  checkpointStore.begin("counter", false);
+  buttonLogStore.begin(legacyLogPath.c_str());
+  endBootPhase(phase);
+
+  phase = bootTimeline.begin("restore");
+  loadButtonCountFromFile();
+  restoreTodayOnceClockSet();
+  endBootPhase(phase);
+
+  phase = bootTimeline.begin("rollups");
+  rollupStore.begin(buttonLogStore);
+  endBootPhase(phase);
 
+  startPipelineTasks();
+  xEventGroupSetBits(bootEvents, BOOT_STORAGE_READY);
+  endBootPhase(setupPhase);
+}
+
+// The network half of the boot. SNTP keeps going in the background and
+// ends the "clock" phase with its first answer, the first request served
+// ends "firstRequest".
+void networkTask(void *parameter)
+{
+  size_t phase = bootTimeline.begin("wifi");
   setupWiFi();
+  endBootPhase(phase);
+
+  clockPhase = bootTimeline.begin("clock");
   setupNTP();
-  setupWebServer();
 
-  pinMode(button1.PIN, INPUT_PULLUP);
-  attachInterrupt(button1.PIN, onButtonPress, FALLING);
+  phase = bootTimeline.begin("waitStorage");
+  xEventGroupWaitBits(bootEvents, BOOT_STORAGE_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+  endBootPhase(phase);
 
-  button1.numberOfPresses = loadButtonCountFromFile();
+  phase = bootTimeline.begin("webServer");
+  firstRequestPhase = bootTimeline.begin("firstRequest");
+  setupWebServer();
+  endBootPhase(phase);
+
+  vTaskDelete(nullptr);
+}
 
-  Serial.println("Setup complete");
+void endBootPhase(size_t phase)
+{
+  if (phase >= bootTimeline.count())
+  {
+    return;
+  }
+  bootTimeline.end(phase);
+  const BootPhase &ended = bootTimeline.phase(phase);
+  Serial.printf("Boot phase %s: %lld us to %lld us, %lld us\n", ended.name, (long long)ended.startMicros,
+                (long long)ended.endMicros, (long long)(ended.endMicros - ended.startMicros));
 }
 
 // Main Loop
+// The pipeline runs in its own tasks; loop() only reports
 void loop()
+{
+  reportHeapWatermark();
+  reportBatchStats();
+  reportLogWriterStats();
+  reportTaskLatency();
+  reportClockSync();
+  reportBootMetrics();
+  delay(1000);
+}
+
+void startPipelineTasks()
+{
+  captureLock = xSemaphoreCreateMutex();
+  settingsLock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(persistenceTask, config::PersistenceTask.name, config::PersistenceTask.stackBytes,
+                          nullptr, config::PersistenceTask.priority, &persistenceTaskHandle,
+                          config::PersistenceTask.core);
+  xTaskCreatePinnedToCore(captureTask, config::CaptureTask.name, config::CaptureTask.stackBytes,
+                          nullptr, config::CaptureTask.priority, &captureTaskHandle, config::CaptureTask.core);
+  // The ISRs had no task to notify during boot, so pulses queued since
+  // would otherwise wait for the next one
+  xTaskNotifyGive(captureTaskHandle);
+
+  clientCleanupTimer = xTimerCreate("wsCleanup", pdMS_TO_TICKS(CLIENT_CLEANUP_INTERVAL), pdTRUE, nullptr, cleanupClients);
+  xTimerStart(clientCleanupTimer, 0);
+}
+
+void cleanupClients(TimerHandle_t timer)
 {
   ws.cleanupClients();
+}
+
+// For requests from the network task that the persistence task carries out
+void wakePersistenceTask()
+{
+  if (persistenceTaskHandle)
+  {
+    xTaskNotifyGive(persistenceTaskHandle);
+  }
+}
+
+// Moves pulses from the ISR rings and the pulse counters into records and
+// wakes the persistence task when there are new ones. Never touches flash.
+// Sleeps until an ISR accepts a pulse or a pulse counter is due.
+void captureTask(void *parameter)
+{
+  while (true)
+  {
+    unsigned long waitMs = ULONG_MAX;
+    for (PulseCounter *counter : pulseCounters)
+    {
+      if (counter && counter->msUntilHarvest() < waitMs)
+      {
+        waitMs = counter->msUntilHarvest();
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, waitMs == ULONG_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+    captureWakeups++;
 
-  handleOnButtonPress();
-  processFifoBuffer();
+    xSemaphoreTake(captureLock, portMAX_DELAY);
+    uint32_t sequenceBefore = pressPipeline.nextSequence();
+    pressPipeline.capture();
+    for (PulseCounter *counter : pulseCounters)
+    {
+      if (counter)
+      {
+        counter->poll();
+      }
+    }
+    bool captured = pressPipeline.nextSequence() != sequenceBefore;
+    xSemaphoreGive(captureLock);
 
-  // String content = readFileContents(config::ButtonLogPath);
-  // if (!content.isEmpty())
-  // {
-  //   Serial.println(content);
-  //   // ws.textAll(content);
-  //   delay(2000);
-  // }
+    if (captured)
+    {
+      wakePersistenceTask();
+    }
+  }
+}
+
+// Everything that writes flash or feeds the sockets: the log, replays,
+// checkpoints, rollups and rate pushes. Sleeps until a record arrives, a
+// request comes in from the network task, a batch window or flush
+// interval runs out, or PersistenceIdleMs passes.
+void persistenceTask(void *parameter)
+{
+  while (true)
+  {
+    unsigned long deadlines[] = {
+        config::PersistenceIdleMs,
+        pressPipeline.msUntilBatch(),
+        logWriter.msUntilFlush(),
+        historyReplay.activeReplays() > 0 ? config::ReplayPollMs : ULONG_MAX};
+    unsigned long waitMs = ULONG_MAX;
+    for (unsigned long deadline : deadlines)
+    {
+      waitMs = deadline < waitMs ? deadline : waitMs;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+    persistenceWakeups++;
+
+    restoreTodayOnceClockSet();
+    handleResetRequest();
+    applySettingsRequest();
+    runBroadcastBenchmark();
+    runThroughputBenchmark();
+    servicePipeline();
+    saveCheckpoint();
+    pushRates();
+    pollRollups();
+  }
 }
 
 // Function Implementations
 
-void IRAM_ATTR onButtonPress()
+void reportHeapWatermark()
+{
+  static unsigned long lastReport = 0;
+  if (millis() - lastReport < HEAP_REPORT_INTERVAL)
+  {
+    return;
+  }
+  lastReport = millis();
+
+  // Min free heap is the all-time low; max alloc shows fragmentation
+  Serial.printf("Heap free: %u, min free: %u, max alloc: %u\n",
+                ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+}
+
+void reportLogWriterStats()
+{
+  static unsigned long lastReport = 0;
+  if (millis() - lastReport < HEAP_REPORT_INTERVAL)
+  {
+    return;
+  }
+  lastReport = millis();
+
+  const LogWriterStats &stats = logWriter.stats();
+  if (stats.flushes == 0)
+  {
+    return;
+  }
+
+  // How much can be lost on power failure and how fast the flash keeps up
+  Serial.printf("Log writer: %lu appends in %lu flushes, flush avg %lu us max %lu us, "
+                "sustains %lu flushes/s, durability window %ld ms / %u bytes\n",
+                (unsigned long)stats.appends, (unsigned long)stats.flushes,
+                (unsigned long)(stats.totalFlushMicros / stats.flushes),
+                (unsigned long)stats.maxFlushMicros,
+                (unsigned long)logWriter.sustainableFlushesPerSecond(),
+                logWriter.durabilityWindowMs() == ULONG_MAX ? -1L : (long)logWriter.durabilityWindowMs(),
+                (unsigned)logWriter.durabilityWindowBytes());
+}
+
+// Edge to capture latency over the last interval, i.e. from the ISR's
+// notification to the capture task having the pulse, next to what the
+// persistence task did meanwhile, so stalls line up with flash writes and
+// replays. Wakeups per second show how idle the tasks are; stack
+// high-water marks show what their stacks can spare.
+void reportTaskLatency()
+{
+  static unsigned long lastReport = 0;
+  static uint32_t lastFlushes = 0;
+  static uint32_t lastCaptureWakeups = 0;
+  static uint32_t lastPersistenceWakeups = 0;
+  if (millis() - lastReport < HEAP_REPORT_INTERVAL)
+  {
+    return;
+  }
+  unsigned long elapsed = millis() - lastReport;
+  lastReport = millis();
+
+  const LatencyHistogram &latency = pressPipeline.captureLatency();
+  const LogWriterStats &stats = logWriter.stats();
+  if (latency.count() > 0)
+  {
+    Serial.printf("Capture latency: %lu pulses, p50 %lu us p99 %lu us max %lu us, "
+                  "meanwhile %lu flushes (max %lu us), %u replays active\n",
+                  (unsigned long)latency.count(), (unsigned long)latency.percentile(0.5f),
+                  (unsigned long)latency.percentile(0.99f), (unsigned long)latency.max(),
+                  (unsigned long)(stats.flushes - lastFlushes), (unsigned long)stats.maxFlushMicros,
+                  (unsigned)historyReplay.activeReplays());
+  }
+  uint32_t captureWoke = captureWakeups;
+  uint32_t persistenceWoke = persistenceWakeups;
+  Serial.printf("Tasks: %s woke %.2f/s, %u bytes stack free; %s woke %.2f/s, %u bytes stack free\n",
+                config::CaptureTask.name, (captureWoke - lastCaptureWakeups) * 1000.0f / elapsed,
+                (unsigned)uxTaskGetStackHighWaterMark(captureTaskHandle),
+                config::PersistenceTask.name, (persistenceWoke - lastPersistenceWakeups) * 1000.0f / elapsed,
+                (unsigned)uxTaskGetStackHighWaterMark(persistenceTaskHandle));
+  lastCaptureWakeups = captureWoke;
+  lastPersistenceWakeups = persistenceWoke;
+  lastFlushes = stats.flushes;
+  pressPipeline.resetCaptureLatency();
+}
+
+// Whether the clock is set, how much it had drifted at the last NTP answer
+// and how many records waited for it
+void reportClockSync()
 {
-  currentInterruptTime = millis();
+  static unsigned long lastReport = 0;
+  if (millis() - lastReport < HEAP_REPORT_INTERVAL)
+  {
+    return;
+  }
+  lastReport = millis();
 
-  if (currentInterruptTime - previousInterruptTime > DEBOUNCE_DELAY)
+  const ClockSyncStats &stats = clockSync.stats();
+  if (!wallClockSet(hal::epochMicros()))
   {
-    button1.isPressed = true;
-    previousInterruptTime = currentInterruptTime;
+    Serial.printf("Clock not set yet, %u records held, %lu without room\n",
+                  (unsigned)pressPipeline.heldRecords(), (unsigned long)pressPipeline.unheldRecords());
+    return;
   }
+  Serial.printf("Clock: %lu NTP answers, first %lu ms after boot, last %lu s ago, error %ld ms (max %ld ms), "
+                "drift %.1f ppm, %lu records backfilled, %lu without room\n",
+                (unsigned long)stats.syncs, (unsigned long)(stats.firstSyncMicros / 1000),
+                (unsigned long)((hal::monotonicMicros() - stats.lastSyncMicros) / 1000000),
+                (long)(stats.lastErrorMicros / 1000), (long)(stats.maxErrorMicros / 1000), stats.driftPpm,
+                (unsigned long)pressPipeline.backfilledRecords(), (unsigned long)pressPipeline.unheldRecords());
 }
 
-void handleOnButtonPress()
+// Once per boot, when the first request has been served: how long that
+// took, next to the average of every boot so far that connected the same
+// way, kept in NVS so the paths can be compared across reboots
+void reportBootMetrics()
 {
-  if (button1.isPressed)
+  static bool reported = false;
+  if (reported || !firstRequestServed)
   {
-    // Get the current time
-    struct tm timeinfo;
-    getLocalTime(&timeinfo);
+    return;
+  }
+  reported = true;
 
-    // strftime formats the timestamp
-    char timestamp[64];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
+  const char *paths[] = {"lease", "direct", "scan"};
+  const char *path = wifiPathName();
+  char countKey[16];
+  char totalKey[16];
+  unsigned long servedMs = (unsigned long)(bootTimeline.phase(firstRequestPhase).endMicros / 1000);
+  snprintf(countKey, sizeof(countKey), "%sBoots", path);
+  snprintf(totalKey, sizeof(totalKey), "%sMs", path);
+  wifiStore.putULong(countKey, wifiStore.getULong(countKey, 0) + 1);
+  wifiStore.putULong(totalKey, wifiStore.getULong(totalKey, 0) + servedMs);
 
-    // Add to fifo queue and +1 count
-    buttonLog.push(String(timestamp));
-    button1.numberOfPresses++;
-    button1.isPressed = false;
-    Serial.println("Button pressed");
+  Serial.printf("Boot: first request served %lu ms after boot, WiFi connected in %lu ms by %s\n",
+                servedMs, wifiConnectMs, path);
+  for (const char *name : paths)
+  {
+    snprintf(countKey, sizeof(countKey), "%sBoots", name);
+    snprintf(totalKey, sizeof(totalKey), "%sMs", name);
+    uint32_t boots = wifiStore.getULong(countKey, 0);
+    if (boots > 0)
+    {
+      Serial.printf("  %s: %lu ms average over %lu boots\n", name,
+                    (unsigned long)(wifiStore.getULong(totalKey, 0) / boots), (unsigned long)boots);
+    }
   }
 }
 
-void processFifoBuffer()
+void reportBatchStats()
+{
+  static unsigned long lastReport = 0;
+  static uint32_t lastEvents = 0;
+  if (millis() - lastReport < HEAP_REPORT_INTERVAL)
+  {
+    return;
+  }
+  unsigned long elapsed = millis() - lastReport;
+  lastReport = millis();
+
+  const BatchSettings &batchSettings = pressPipeline.batching();
+  const BatchStats &batchStats = pressPipeline.stats();
+  if (batchStats.batches == 0)
+  {
+    return;
+  }
+
+  // Throughput is over the last interval, the rest since boot or last reset
+  const LatencyHistogram &latency = pressPipeline.latency();
+  Serial.printf("Batch size %u, window %lu ms: %lu presses/min, avg batch %.1f, "
+                "latency avg %lu ms p50 %lu ms p99 %lu ms max %lu ms, emit %lu us/batch\n",
+                (unsigned)batchSettings.maxSize, batchSettings.windowMs,
+                (unsigned long)((batchStats.events - lastEvents) * 60000ULL / elapsed),
+                (float)batchStats.events / batchStats.batches,
+                (unsigned long)(batchStats.totalLatencyMs / batchStats.events),
+                (unsigned long)latency.percentile(0.5f), (unsigned long)latency.percentile(0.99f),
+                (unsigned long)batchStats.maxLatencyMs,
+                (unsigned long)(batchStats.totalEmitMicros / batchStats.batches));
+  lastEvents = batchStats.events;
+}
+
+// Current rates, averages and today's totals for every channel, pushed to
+// the clients that are not replaying history
+void pushRates()
 {
-  while (!buttonLog.empty())
+  const unsigned long RATE_PUSH_INTERVAL = 1000;
+  static unsigned long lastPush = 0;
+  if (millis() - lastPush < RATE_PUSH_INTERVAL || ws.count() == 0)
   {
-    String buttonPressTimestamp = buttonLog.front();
-    buttonLog.pop();
+    return;
+  }
+  lastPush = millis();
 
-    Serial.println("Pulse time - Fifo: " + buttonPressTimestamp);
+  AsyncWebSocketSharedBuffer frame = std::make_shared<std::vector<uint8_t>>(RateEngine::JSON_MAX_LENGTH);
+  xSemaphoreTake(captureLock, portMAX_DELAY);
+  size_t length = rateEngine.encodeJson((char *)frame->data(), frame->size(),
+                                        hal::monotonicMicros(), (uint32_t)time(nullptr));
+  xSemaphoreGive(captureLock);
+  frame->resize(length);
+  historyReplay.broadcast(frame);
+}
 
-    JsonDocument doc;
-    doc["buttonPressTimestamp"] = buttonPressTimestamp;
-    doc["buttonPressCount"] = button1.numberOfPresses;
+// Writes out buckets that ended without a press since
+void pollRollups()
+{
+  const unsigned long ROLLUP_POLL_INTERVAL = 1000;
+  static unsigned long lastPoll = 0;
+  if (millis() - lastPoll < ROLLUP_POLL_INTERVAL)
+  {
+    return;
+  }
+  lastPoll = millis();
+  rollupStore.poll((uint32_t)time(nullptr));
+}
 
-    String jsonString;
-    serializeJson(doc, jsonString);
+// Measures what one full-size batch frame costs to queue for every connected
+// client, copied per client and shared. Open 1, 4 or 8 dashboards and run
+// it from Service Mode.
+void runBroadcastBenchmark()
+{
+  if (!broadcastBenchmarkRequested)
+  {
+    return;
+  }
+  broadcastBenchmarkRequested = false;
+
+  BroadcastCost cost = measureBroadcast(ws, 4, []()
+                                        { delay(200); });
+  Serial.printf("Broadcast benchmark, %u clients, %u byte frame: copy %.1f us %ld bytes, "
+                "shared %.1f us %ld bytes\n",
+                (unsigned)cost.clients, (unsigned)cost.frameBytes,
+                cost.copyMicros, (long)cost.copyHeap, cost.sharedMicros, (long)cost.sharedHeap);
+}
 
-    ws.textAll(jsonString);
-    writeToFile(config::ButtonLogPath, jsonString);
+// Steps a second pipeline from 10 to 50000 pulses per second until it
+// drops or fails to log a pulse, printing BENCH lines on Serial. It has its
+// own log under /bench, removed afterwards, and its frames go out between
+// start and end markers the page skips. Blocks the persistence task for
+// the whole run.
+void runThroughputBenchmark()
+{
+  if (!throughputBenchmarkRequested)
+  {
+    return;
   }
+  throughputBenchmarkRequested = false;
+
+  std::unique_ptr<LogWriter> benchWriter(new LogWriter(SPIFFS, "/bench/legacy.log", logFormat, FlushPolicy::Interval, 1000));
+  std::unique_ptr<SegmentedLog> benchLog(new SegmentedLog(SPIFFS, "/bench", logFormat, *benchWriter, LOG_SEGMENT_SIZE, LOG_RETENTION));
+  std::unique_ptr<HistoryReplay> benchReplay(new HistoryReplay(ws, *benchLog, *benchWriter));
+  std::unique_ptr<PressPipeline> benchPipeline(new PressPipeline(*benchLog, *benchReplay));
+  benchLog->begin(nullptr);
+  benchPipeline->setBatching(pressPipeline.batching().maxSize, pressPipeline.batching().windowMs);
+
+  ws.textAll("{\"benchmark\":\"start\"}");
+  ThroughputBenchmark benchmark(*benchPipeline, *benchReplay, *benchWriter, ws);
+  // The run holds this task for a dozen seconds or more; live presses
+  // would fill the event pool in the meantime
+  benchmark.setBackgroundWork(servicePipeline);
+  benchmark.run(1000);
+  ws.textAll("{\"benchmark\":\"end\"}");
+
+  benchLog->clear();
+  benchWriter->close();
+}
+
+// The persistence task's share of the live pipeline: replay, numbering,
+// batches to the log and flushes
+void servicePipeline()
+{
+  historyReplay.pump();
+  reserveSequences();
+  pressPipeline.process();
+  logWriter.poll();
 }
 
 // WiFi setup
 
+// Connects straight to the cached access point and channel when there is
+// one, reusing the cached lease unless it has been reused
+// WifiLeaseReuseBoots times already, and falls back to a full scan with
+// DHCP like a first boot.
 void setupWiFi()
 {
-  WiFi.begin(config::ssid, config::password);
-  Serial.print("Connecting to WiFi...");
   unsigned long startTime = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - startTime < 10000)
+  // The cache below replaces the core's own copy of the credentials in flash
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+
+  WiFiCache cache;
+  bool cached = loadWiFiCache(cache);
+  bool connected = false;
+  wifiPath = WiFiPath::Cached;
+  if (cached)
   {
-    Serial.print(".");
-    delay(100);
+    wifiLeaseReused = cache.ip != 0 && cache.leaseReuses < config::WifiLeaseReuseBoots;
+    if (wifiLeaseReused)
+    {
+      WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    }
+    Serial.printf("Connecting to the cached access point on channel %u%s...\n",
+                  (unsigned)cache.channel, wifiLeaseReused ? " with the cached lease" : "");
+    WiFi.begin(config::ssid, config::password, cache.channel, cache.bssid);
+    connected = waitForWiFi(WIFI_CACHED_TIMEOUT);
+    if (!connected)
+    {
+      // Moved, switched off or on another channel: scan and cache what that finds
+      Serial.println("Cached access point did not answer, scanning");
+      WiFi.disconnect();
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+      wifiLeaseReused = false;
+    }
+  }
+  if (!connected)
+  {
+    wifiPath = WiFiPath::Scan;
+    Serial.println("Connecting to WiFi...");
+    WiFi.begin(config::ssid, config::password);
+    connected = waitForWiFi(WIFI_SCAN_TIMEOUT);
   }
 
-  if (WiFi.status() != WL_CONNECTED)
+  wifiConnectMs = millis() - startTime;
+  if (!connected)
   {
-    Serial.println("\nFailed to connect to WiFi");
+    wifiPath = WiFiPath::Failed;
+    Serial.printf("Failed to connect to WiFi after %lu ms\n", wifiConnectMs);
+    return;
   }
-  else
+  Serial.printf("Connected to WiFi in %lu ms (%s, %s), IP Address: %s\n", wifiConnectMs,
+                wifiPath == WiFiPath::Cached ? "cached access point" : "scan",
+                wifiLeaseReused ? "cached lease" : "DHCP", WiFi.localIP().toString().c_str());
+  saveWiFiCache(cache, cached);
+}
+
+// How setupWiFi() got on: the cached access point with its lease or with
+// DHCP, a scan, or not at all
+const char *wifiPathName()
+{
+  switch (wifiPath)
+  {
+  case WiFiPath::Cached:
+    return wifiLeaseReused ? "lease" : "direct";
+  case WiFiPath::Scan:
+    return "scan";
+  default:
+    return "failed";
+  }
+}
+
+bool waitForWiFi(unsigned long timeoutMs)
+{
+  unsigned long startTime = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - startTime < timeoutMs)
+  {
+    delay(10);
+  }
+  return WiFi.status() == WL_CONNECTED;
+}
+
+bool loadWiFiCache(WiFiCache &cache)
+{
+  wifiStore.begin("wifi", false);
+  return wifiStore.getBytesLength("cache") == sizeof(cache) &&
+         wifiStore.getBytes("cache", &cache, sizeof(cache)) == sizeof(cache) &&
+         strncmp(cache.ssid, config::ssid, sizeof(cache.ssid)) == 0;
+}
+
+// Written only when something changed, so a boot on the cached path costs
+// one small NVS write for the reuse count and nothing more
+void saveWiFiCache(const WiFiCache &previous, bool cached)
+{
+  WiFiCache cache = {};
+  strncpy(cache.ssid, config::ssid, sizeof(cache.ssid) - 1);
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = (uint8_t)WiFi.channel();
+  cache.leaseReuses = wifiLeaseReused ? previous.leaseReuses + 1 : 0;
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.subnet = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+  if (config::WifiLeaseReuseBoots == 0)
+  {
+    cache.ip = 0;
+  }
+  if (!cached || memcmp(&cache, &previous, sizeof(cache)) != 0)
   {
-    Serial.println("\nConnected to WiFi");
-    Serial.println("IP Address: " + WiFi.localIP().toString());
+    wifiStore.putBytes("cache", &cache, sizeof(cache));
   }
 }
 
 /// NTP setup
 
+// Starts SNTP and returns right away. Counting doesn't need the clock:
+// the pipeline holds records until the first answer sets it. Later answers
+// are slewed in rather than stepped, so timestamps never run backwards.
 void setupNTP()
 {
-  configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
-  if (!waitForNTPSync())
+  sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+  sntp_set_sync_interval(NTP_RESYNC_INTERVAL);
+  sntp_set_time_sync_notification_cb(onTimeSync);
+  configTzTime(TIME_ZONE, NTP_SERVER);
+}
+
+// Runs in the lwIP task for every answer. In smooth mode the clock is only
+// being slewed at this point, so it still shows the error that built up;
+// the first answer has already stepped it.
+void onTimeSync(struct timeval *ntpTime)
+{
+  bool first = !clockSync.synced();
+  clockSync.onSync(hal::monotonicMicros(), (int64_t)ntpTime->tv_sec * 1000000 + ntpTime->tv_usec,
+                   hal::epochMicros());
+  if (first)
   {
-    Serial.println("NTP sync failed! Restarting...");
-    ESP.restart();
+    endBootPhase(clockPhase);
   }
+  // Held records can go out now
+  wakePersistenceTask();
 }
 
-bool waitForNTPSync(int maxAttempts)
+// Runs at boot, where a soft reset may have kept the clock, and then from
+// the persistence task until the clock is set
+void restoreTodayOnceClockSet()
 {
-  Serial.println("Waiting for NTP sync...");
-  struct tm timeinfo;
-  for (int attempts = 0; attempts < maxAttempts; ++attempts)
+  if (todayRestored || !wallClockSet(hal::epochMicros()))
   {
-    if (getLocalTime(&timeinfo))
-    {
-      Serial.println("NTP synchronized successfully!");
-      return true;
-    }
-    delay(1000);
-    Serial.print(".");
+    return;
+  }
+  if (captureLock)
+  {
+    xSemaphoreTake(captureLock, portMAX_DELAY);
+  }
+  restoreTodayFromLog();
+  todayRestored = true;
+  if (captureLock)
+  {
+    xSemaphoreGive(captureLock);
   }
-  Serial.println("\nFailed to sync with NTP server!");
-  return false;
 }
 
 void setupWebServer()
 {
+  // Time to the first request served is the boot metric that counts
+  server.addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next)
+                       {
+                         next();
+                         if (!firstRequestServed)
+                         {
+                           endBootPhase(firstRequestPhase);
+                           firstRequestServed = true;
+                         } });
   server.on("/", HTTP_GET, handleRootRequest);
   server.on("/serviceMode", HTTP_POST, handleServiceModeRequest);
+  server.on("/channels", HTTP_GET, handleChannelsRequest);
+  server.on("/rollups", HTTP_GET, handleRollupsRequest);
+  server.on("/boot", HTTP_GET, handleBootRequest);
+  server.on("/settings", HTTP_GET, handleGetSettingsRequest);
+  server.on("/settings", HTTP_POST, handleSetSettingsRequest);
 
   ws.onEvent(handleWebSocketEvent);
 
@@ -219,29 +920,122 @@ void handleRootRequest(AsyncWebServerRequest *request)
   request->send(SPIFFS, "/index.html", "text/html");
 }
 
+// The channel table, so the page knows names and units before any press
+void handleChannelsRequest(AsyncWebServerRequest *request)
+{
+  JsonDocument doc;
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    const ChannelConfig &input = config::Channels[channel];
+    JsonObject entry = doc.add<JsonObject>();
+    entry["channel"] = channel;
+    entry["name"] = input.name;
+    entry["unit"] = input.unit;
+    entry["unitsPerPulse"] = input.unitsPerPulse;
+    entry["count"] = pressPipeline.count(channel);
+  }
+  String json;
+  serializeJson(doc, json);
+  request->send(200, "application/json", json);
+}
+
+// Boot timeline, microseconds since boot, end 0 while a phase still runs:
+// {"phases":[{"name":"wifi","start":N,"end":N},...],"wifi":"lease","wifiConnectMs":N}
+void handleBootRequest(AsyncWebServerRequest *request)
+{
+  JsonDocument doc;
+  JsonArray phases = doc["phases"].to<JsonArray>();
+  for (size_t i = 0; i < bootTimeline.count(); i++)
+  {
+    const BootPhase &phase = bootTimeline.phase(i);
+    JsonObject entry = phases.add<JsonObject>();
+    entry["name"] = phase.name;
+    entry["start"] = phase.startMicros;
+    entry["end"] = phase.endMicros;
+  }
+  doc["wifi"] = wifiPathName();
+  doc["wifiConnectMs"] = wifiConnectMs;
+  String json;
+  serializeJson(doc, json);
+  request->send(200, "application/json", json);
+}
+
+// Pulse totals per bucket: /rollups?resolution=minute|hour|day&from=E&to=E
+// with epoch seconds, to defaulting to now and from to 30 buckets earlier.
+// {"resolution":"day","channels":N,"buckets":[[start,pulses...],...],"next":E}
+// holds only buckets with pulses; a non-zero next is the from of the
+// following page.
+void handleRollupsRequest(AsyncWebServerRequest *request)
+{
+  RollupResolution resolution = RollupResolution::Hour;
+  if (request->hasParam("resolution") &&
+      !RollupStore::parseResolution(request->getParam("resolution")->value().c_str(), resolution))
+  {
+    request->send(400, "text/plain", "resolution must be minute, hour or day");
+    return;
+  }
+  uint32_t to = request->hasParam("to") ? request->getParam("to")->value().toInt() : (uint32_t)time(nullptr);
+  uint32_t span = 30 * RollupStore::bucketSeconds(resolution);
+  uint32_t from = request->hasParam("from") ? request->getParam("from")->value().toInt() : (to > span ? to - span : 0);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->printf("{\"resolution\":\"%s\",\"channels\":%u,\"buckets\":[",
+                   RollupStore::resolutionName(resolution), (unsigned)config::ChannelCount);
+  bool first = true;
+  uint32_t next = rollupStore.read(resolution, from, to, ROLLUP_MAX_BUCKETS, [&](const RollupBucket &bucket)
+                                   {
+    response->printf("%s[%lu", first ? "" : ",", (unsigned long)bucket.start);
+    for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+    {
+      response->printf(",%lu", (unsigned long)bucket.pulses[channel]);
+    }
+    response->print("]");
+    first = false; });
+  response->printf("],\"next\":%lu}", (unsigned long)next);
+  request->send(response);
+}
+
 void handleWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
 {
+  // History is streamed from the persistence task, not the network task
   if (type == WS_EVT_CONNECT)
   {
-    File file = SPIFFS.open(config::ButtonLogPath, FILE_READ);
-    if (!file)
+    // arg is the upgrade request. The library echoes whatever protocol the
+    // client asked for, so the page asks for EVENT_FRAME_PROTOCOL alone.
+    // A reconnecting page puts the last sequence it has in ?since=N, so the
+    // replay starts there and never sends what the page already shows.
+    AsyncWebServerRequest *request = (AsyncWebServerRequest *)arg;
+    const AsyncWebHeader *protocol = request ? request->getHeader("Sec-WebSocket-Protocol") : nullptr;
+    bool binary = protocol && protocol->value() == EVENT_FRAME_PROTOCOL;
+    if (request && request->hasParam("since"))
     {
-      Serial.println("Failed to open file for reading");
-      return;
+      uint32_t since = strtoul(request->getParam("since")->value().c_str(), nullptr, 10);
+      historyReplay.clientConnected(client->id(), binary, since);
     }
-
-    // Send each line as a separate WebSocket message
-    while (file.available())
+    else
     {
-      String jsonLine = file.readStringUntil('\n');
-      if (!jsonLine.isEmpty())
+      historyReplay.clientConnected(client->id(), binary);
+    }
+  }
+  else if (type == WS_EVT_DISCONNECT)
+  {
+    historyReplay.clientDisconnected(client->id());
+  }
+  else if (type == WS_EVT_DATA)
+  {
+    // {"since":N} asks for the records after sequence N only, from clients
+    // that could not put it in the upgrade request
+    AwsFrameInfo *info = (AwsFrameInfo *)arg;
+    if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT)
+    {
+      JsonDocument doc;
+      if (!deserializeJson(doc, (const char *)data, len) && !doc["since"].isNull())
       {
-        client->text(jsonLine);
+        historyReplay.clientRequestedSince(client->id(), doc["since"].as<uint32_t>());
       }
     }
-
-    file.close();
   }
+  wakePersistenceTask();
 }
 
 void handleServiceModeRequest(AsyncWebServerRequest *request)
@@ -255,55 +1049,346 @@ void handleServiceModeRequest(AsyncWebServerRequest *request)
   String action = request->getParam("action", true)->value();
   if (action == "reset")
   {
-    // Clear the button log
-    SPIFFS.remove(config::ButtonLogPath);
-    button1.numberOfPresses = 0;
+    // The log writer belongs to the persistence task, so the reset runs there
+    resetRequested = true;
+    wakePersistenceTask();
     request->send(200, "text/plain", "Data reset successfully");
     return;
   }
+  if (action == "broadcastBenchmark")
+  {
+    broadcastBenchmarkRequested = true;
+    wakePersistenceTask();
+    request->send(200, "text/plain", "Broadcast benchmark started, results on Serial");
+    return;
+  }
+  if (action == "throughputBenchmark")
+  {
+    throughputBenchmarkRequested = true;
+    wakePersistenceTask();
+    request->send(200, "text/plain", "Throughput benchmark started, results on Serial");
+    return;
+  }
 
   request->send(400, "text/plain", "Invalid action");
 }
 
-// File handling functions
+void handleGetSettingsRequest(AsyncWebServerRequest *request)
+{
+  const BatchSettings &batchSettings = pressPipeline.batching();
+  const BatchStats &batchStats = pressPipeline.stats();
+  const LogWriterStats &logStats = logWriter.stats();
+  char json[384];
+  snprintf(json, sizeof(json),
+           "{\"batchSize\":%u,\"batchWindow\":%lu,\"batches\":%lu,\"events\":%lu,"
+           "\"avgLatencyMs\":%lu,\"maxLatencyMs\":%lu,"
+           "\"flushPolicy\":\"%s\",\"flushInterval\":%lu,\"flushes\":%lu,"
+           "\"avgFlushMicros\":%lu,\"flushesPerSecond\":%lu,"
+           "\"durabilityWindowMs\":%ld,\"durabilityWindowBytes\":%u}",
+           (unsigned)batchSettings.maxSize, batchSettings.windowMs,
+           (unsigned long)batchStats.batches, (unsigned long)batchStats.events,
+           (unsigned long)(batchStats.events ? batchStats.totalLatencyMs / batchStats.events : 0),
+           (unsigned long)batchStats.maxLatencyMs,
+           flushPolicyName(logWriter.policy()), logWriter.interval(),
+           (unsigned long)logStats.flushes,
+           (unsigned long)(logStats.flushes ? logStats.totalFlushMicros / logStats.flushes : 0),
+           (unsigned long)logWriter.sustainableFlushesPerSecond(),
+           logWriter.durabilityWindowMs() == ULONG_MAX ? -1L : (long)logWriter.durabilityWindowMs(),
+           (unsigned)logWriter.durabilityWindowBytes());
+  request->send(200, "application/json", json);
+}
+
+void handleSetSettingsRequest(AsyncWebServerRequest *request)
+{
+  long batchSize = -1;
+  if (request->hasParam("batchSize", true))
+  {
+    batchSize = request->getParam("batchSize", true)->value().toInt();
+    if (batchSize < 1 || batchSize > (long)PressPipeline::MAX_BATCH_SIZE)
+    {
+      request->send(400, "text/plain", "batchSize must be 1-" + String((unsigned)PressPipeline::MAX_BATCH_SIZE));
+      return;
+    }
+  }
+
+  long batchWindow = -1;
+  if (request->hasParam("batchWindow", true))
+  {
+    batchWindow = request->getParam("batchWindow", true)->value().toInt();
+    if (batchWindow < 0)
+    {
+      request->send(400, "text/plain", "batchWindow must not be negative");
+      return;
+    }
+  }
+
+  bool policyGiven = request->hasParam("flushPolicy", true);
+  FlushPolicy policy = FlushPolicy::Interval;
+  if (policyGiven)
+  {
+    String name = request->getParam("flushPolicy", true)->value();
+    if (name == "record")
+    {
+      policy = FlushPolicy::EveryRecord;
+    }
+    else if (name == "interval")
+    {
+      policy = FlushPolicy::Interval;
+    }
+    else if (name == "full")
+    {
+      policy = FlushPolicy::BufferFull;
+    }
+    else
+    {
+      request->send(400, "text/plain", "flushPolicy must be record, interval or full");
+      return;
+    }
+  }
 
-void writeToFile(const String &filename, const String &data)
+  long flushInterval = -1;
+  if (request->hasParam("flushInterval", true))
+  {
+    flushInterval = request->getParam("flushInterval", true)->value().toInt();
+    if (flushInterval < 1)
+    {
+      request->send(400, "text/plain", "flushInterval must be at least 1");
+      return;
+    }
+  }
+
+  // Settings not given keep their value, or the one a request still
+  // waiting for the persistence task asked for
+  xSemaphoreTake(settingsLock, portMAX_DELAY);
+  if (!settingsRequested)
+  {
+    pendingSettings = {pressPipeline.batching().maxSize, pressPipeline.batching().windowMs,
+                       logWriter.policy(), logWriter.interval()};
+  }
+  if (batchSize >= 0)
+  {
+    pendingSettings.batchSize = batchSize;
+  }
+  if (batchWindow >= 0)
+  {
+    pendingSettings.batchWindow = batchWindow;
+  }
+  if (policyGiven)
+  {
+    pendingSettings.flushPolicy = policy;
+  }
+  if (flushInterval >= 0)
+  {
+    pendingSettings.flushInterval = flushInterval;
+  }
+  settingsRequested = true;
+  xSemaphoreGive(settingsLock);
+
+  wakePersistenceTask();
+  request->send(200, "text/plain", "Settings saved");
+}
+
+const char *flushPolicyName(FlushPolicy policy)
+{
+  switch (policy)
+  {
+  case FlushPolicy::EveryRecord:
+    return "record";
+  case FlushPolicy::Interval:
+    return "interval";
+  default:
+    return "full";
+  }
+}
+
+void handleResetRequest()
 {
-  File file = SPIFFS.open(filename, FILE_APPEND);
-  if (!file)
+  if (!resetRequested)
   {
-    Serial.println("Failed to open file for writing");
     return;
   }
-  file.println(data);
-  file.close();
+
+  // Clear the button log. Capture waits, so no pulse is counted against
+  // the old counts after the log is gone.
+  xSemaphoreTake(captureLock, portMAX_DELAY);
+  historyReplay.cancelAll();
+  buttonLogStore.clear();
+  checkpointStore.clear();
+  checkpointStore.putULong("sequence", pressPipeline.nextSequence());
+  checkpointStore.putULong("seqLimit", reservedSequences);
+  pressPipeline.resetCount();
+  memset(checkpointCounts, 0, sizeof(checkpointCounts));
+  memset(bootCounts, 0, sizeof(bootCounts));
+  rateEngine.reset();
+  rollupStore.clear();
+  xSemaphoreGive(captureLock);
+  resetRequested = false;
 }
 
-ulong loadButtonCountFromFile()
+void applySettingsRequest()
 {
-  String content = readFileContents(config::ButtonLogPath);
+  if (!settingsRequested)
+  {
+    return;
+  }
 
-  JsonDocument doc;
+  xSemaphoreTake(settingsLock, portMAX_DELAY);
+  PendingSettings settings = pendingSettings;
+  settingsRequested = false;
+  xSemaphoreGive(settingsLock);
+
+  pressPipeline.setBatching(settings.batchSize, settings.batchWindow);
+  logWriter.setPolicy(settings.flushPolicy, settings.flushInterval);
+  // New settings start a fresh measurement
+  pressPipeline.resetStats();
+  logWriter.resetStats();
+}
+
+void saveCheckpoint()
+{
+  static unsigned long lastCheckpoint = 0;
+  bool changed = false;
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    changed = changed || pressPipeline.loggedCount(channel) != checkpointCounts[channel];
+  }
+  if (!changed || millis() - lastCheckpoint < CHECKPOINT_INTERVAL)
+  {
+    return;
+  }
+
+  // Only a fully flushed log matches the logged count
+  if (logWriter.buffered() > 0)
+  {
+    return;
+  }
+  lastCheckpoint = millis();
 
-  deserializeJson(doc, content);
+  char key[16];
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    checkpointCountKey(channel, key, sizeof(key));
+    checkpointStore.putULong(key, pressPipeline.loggedCount(channel));
+    checkpointCounts[channel] = pressPipeline.loggedCount(channel);
+  }
+  checkpointStore.putULong("segment", buttonLogStore.currentSegment());
+  checkpointStore.putULong("offset", logWriter.size());
+  checkpointStore.putULong("sequence", pressPipeline.nextSequence());
+}
+
+void reserveSequences()
+{
+  if (pressPipeline.nextSequence() + SEQUENCE_RESERVE_BLOCK / 2 <= reservedSequences)
+  {
+    return;
+  }
+  reservedSequences = pressPipeline.nextSequence() + SEQUENCE_RESERVE_BLOCK;
+  checkpointStore.putULong("seqLimit", reservedSequences);
+}
+
+// Channel 0 keeps the key from before there were channels
+void checkpointCountKey(uint8_t channel, char *key, size_t capacity)
+{
+  if (channel == 0)
+  {
+    snprintf(key, capacity, "count");
+  }
+  else
+  {
+    snprintf(key, capacity, "count%u", (unsigned)channel);
+  }
+}
+
+// File handling functions
+
+void loadButtonCountFromFile()
+{
+  unsigned long startMicros = micros();
 
-  return doc["buttonPressCount"].as<ulong>();
+  CountCheckpoint checkpoint = {};
+  checkpoint.segment = checkpointStore.getULong("segment", 0);
+  checkpoint.offset = checkpointStore.getULong("offset", 0);
+  checkpoint.nextSequence = checkpointStore.getULong("sequence", 0);
+  checkpoint.sequenceLimit = checkpointStore.getULong("seqLimit", 0);
+  char key[16];
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    checkpointCountKey(channel, key, sizeof(key));
+    checkpoint.counts[channel] = checkpointStore.getULong(key, 0);
+  }
+
+  restoreCounts(pressPipeline, buttonLogStore, checkpoint);
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
+  {
+    ulong count = pressPipeline.count(channel);
+    checkpointCounts[channel] = bootCounts[channel] = count;
+    Serial.printf("%s count %lu\n", config::Channels[channel].name, count);
+  }
+  reserveSequences();
+
+  Serial.printf("Counts restored in %lu us (checkpoint at segment %lu, %u bytes)\n",
+                micros() - startMicros, (unsigned long)checkpoint.segment, (unsigned)checkpoint.offset);
 }
 
-String readFileContents(const String &filename)
+// Today's totals start from the log so a reboot does not zero them. A
+// channel's baseline is the count of its last record before midnight, or
+// the count before its first record today when the segment holds nothing
+// earlier for it, or its count at boot when it has no record today at all.
+// The clock may have been set long after boot, so that count need not be
+// the current one.
+void restoreTodayFromLog()
 {
-  File file = SPIFFS.open(filename, FILE_READ);
-  if (!file)
+  time_t now = time(nullptr);
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+  timeinfo.tm_hour = 0;
+  timeinfo.tm_min = 0;
+  timeinfo.tm_sec = 0;
+  timeinfo.tm_isdst = -1;
+  uint32_t midnight = (uint32_t)mktime(&timeinfo);
+
+  ulong baseline[config::ChannelCount] = {};
+  bool known[config::ChannelCount] = {};
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
   {
-    Serial.println("Failed to open file for reading");
-    return "";
+    baseline[channel] = bootCounts[channel];
   }
+  size_t unknown = config::ChannelCount;
+  LogCursor cursor(buttonLogStore);
+  cursor.seekSegment(buttonLogStore.findEpoch(midnight));
+  EventRecord record;
+  while (cursor.next(record))
+  {
+    if (record.channel >= config::ChannelCount)
+    {
+      continue;
+    }
+    if (record.epochSeconds() < midnight)
+    {
+      baseline[record.channel] = record.count;
+      unknown -= known[record.channel] ? 0 : 1;
+      known[record.channel] = true;
+    }
+    else
+    {
+      if (!known[record.channel])
+      {
+        baseline[record.channel] = record.count > 0 ? record.count - 1 : 0;
+        known[record.channel] = true;
+        unknown--;
+      }
+      if (unknown == 0)
+      {
+        break;
+      }
+    }
+  }
+  cursor.close();
 
-  String content;
-  while (file.available())
+  for (uint8_t channel = 0; channel < config::ChannelCount; channel++)
   {
-    content = file.readStringUntil('\n');
+    ulong count = pressPipeline.count(channel);
+    ulong today = count > baseline[channel] ? count - baseline[channel] : 0;
+    rateEngine.restoreToday(channel, today, (uint32_t)now);
   }
-  file.close();
-  return content;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1332 @@
+// Host build of the press pipeline (pio run -e native). A pulse train is
+// fed through the simulated button pin into the same ISR trampoline and
+// PressPipeline as on the device, on a virtual clock, with the log in a
+// temp directory and loopback WebSocket clients on the other end.
+//
+// Usage: program [constant|poisson|bursty|chatter|<file>|benchmark|ring|replay|restore|broadcast|string-queue] [options]
+//   --presses N   presses to generate (1000)
+//   --period MS   press period, the mean for poisson (300)
+//   --burst N     presses per burst (8)
+//   --gap MS      pause between bursts (5000)
+//   --bounces N   most bounces per press for chatter (4)
+//   --clients N   WebSocket clients (4)
+//   --binary-clients N  how many of them negotiate binary frames (0)
+//   --channels N  channels, each on its own pin with its own train (1)
+//   --loop-us N   virtual time between loop() passes (1000)
+//   --wake        pass when the ISR accepts a pulse or a deadline is due,
+//                 as the device's tasks do, instead of every --loop-us
+//   --seed N      seed for poisson and chatter (1)
+//   --binary      binary log instead of JSON lines
+//   --pcnt        count on the simulated pulse counter instead of the ISR
+//   --filter-ns N pulse counter glitch filter (10000)
+//   --harvest-ms N  pulse counter harvest interval (1000)
+//   --ntp         start with the clock unset and set it from an NTP stand-in
+//   --ntp-delay-ms N  how long the stand-in takes to answer (2000)
+//   --ntp-drops N     requests at boot it doesn't answer, retried every 15 s (0)
+//   --ntp-resync-ms N how often the clock asks again once set (60000)
+//   --drift-ppm N   how much faster the stand-in's clock runs (0)
+//   --profile     let real time run as well, to time the loop() stages and
+//                 the JSON and binary frame encoders
+//   --step-ms N   how long benchmark and ring run each rate (1000)
+//   --rounds N    times broadcast queues each kind of frame (1000)
+//   --drain-us N  how long ring's consumer pauses between drains (1000)
+//   --ring-rate N pulses/s ring has to get through without loss (16000)
+//   --log-records N  records replay and restore fill the log with (100000)
+//   --slow-passes N  loop() passes per frame replay's slow client reads (10)
+//   --batch-size N   records per batch, as /settings sets it (16)
+//   --batch-window MS  longest a batch waits to fill, as /settings sets it (250)
+//
+// Without --profile only the simulation moves the clock, so a run repeats
+// exactly. Exits non-zero when the log or a client is missing a press the
+// pipeline counted. With --pcnt a record carries a harvest, not a press, so
+// the log is checked by its last count instead. With --ntp every record
+// also has to carry a time from after the clock was set, and the timestamps
+// are compared with the stand-in's clock at the press. Binary clients
+// have to decode exactly the records in the log. Every run first reads
+// back each line shape older logs hold.
+//
+// "benchmark" runs the ThroughputBenchmark instead, in real time, and
+// prints the same BENCH lines as the device.
+//
+// "ring" stresses EventRing with a producer and a consumer thread, see
+// ring_stress.h, and prints RING lines.
+//
+// "replay" fills the log, then checks that clients of every kind, one of
+// them slow, get the paged replay complete and in order, see
+// checkPagedReplay().
+//
+// "restore" fills the log and times the boot restore of the counts from
+// it against different checkpoints, see checkRestore().
+//
+// "string-queue" runs the train through the capture-to-broadcast path as
+// it was before the EventRecord pool, see checkStringQueue(), and prints
+// the same heap lines as a normal run for comparison.
+//
+// "broadcast" times queueing a full-size batch frame for --clients
+// clients, copied per client and shared, in real time, as the device's
+// Broadcast Benchmark does, see checkBroadcast().
+
+#include <stdlib.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <map>
+#include <queue>
+#include <utility>
+#include "hal/hal.h"
+#include "broadcast_benchmark.h"
+#include "clock_sync.h"
+#include "count_checkpoint.h"
+#include "event_codec.h"
+#include "event_log_format.h"
+#include "history_replay.h"
+#include "log_writer.h"
+#include "ntp_stand_in.h"
+#include "press_pipeline.h"
+#include "pulse_counter.h"
+#include "pulse_train.h"
+#include "ring_stress.h"
+#include "rate_engine.h"
+#include "rollup_store.h"
+#include "segmented_log.h"
+#include "throughput_benchmark.h"
+
+// Channel N is on pin BUTTON_PIN + N
+static const uint8_t BUTTON_PIN = 4;
+// As PersistenceIdleMs and ReplayPollMs in config.h
+static const unsigned long IDLE_WAKE_MS = 1000;
+static const unsigned long REPLAY_POLL_MS = 10;
+
+struct Options
+{
+  const char *train = "constant";
+  unsigned long presses = 1000;
+  unsigned long periodMs = 300;
+  unsigned long burst = 8;
+  unsigned long gapMs = 5000;
+  unsigned long bounces = 4;
+  unsigned long clients = 4;
+  unsigned long binaryClients = 0;
+  unsigned long channels = 1;
+  unsigned long loopMicros = 1000;
+  unsigned long seed = 1;
+  unsigned long stepMs = 1000;
+  unsigned long rounds = 1000;
+  unsigned long drainMicros = 1000;
+  unsigned long ringRate = 16000;
+  unsigned long logRecords = 100000;
+  unsigned long slowPasses = 10;
+  // ULONG_MAX keeps the pipeline's default
+  unsigned long batchSize = ULONG_MAX;
+  unsigned long batchWindowMs = ULONG_MAX;
+  unsigned long filterNanos = PulseCounter::DEFAULT_FILTER_NANOS;
+  unsigned long harvestMs = PulseCounter::DEFAULT_HARVEST_INTERVAL;
+  unsigned long ntpDelayMs = 2000;
+  unsigned long ntpDrops = 0;
+  unsigned long ntpResyncMs = 60000;
+  unsigned long driftPpm = 0;
+  bool binary = false;
+  bool pcnt = false;
+  bool profile = false;
+  bool wake = false;
+  bool ntp = false;
+};
+
+struct StageTimes
+{
+  uint64_t capture;
+  uint64_t replay;
+  uint64_t process;
+  uint64_t poll;
+  uint64_t delivery;
+};
+
+// An edge of one channel's train
+struct ChannelEdge
+{
+  uint64_t atMicros;
+  uint8_t channel;
+  uint8_t level;
+};
+
+static PressPipeline *pipeline = nullptr;
+static PulseCounter *pulseCounters[PressPipeline::MAX_CHANNELS] = {};
+static bool wakeRequested = false;
+// With --ntp, when each channel's accepted presses happened
+static bool recordPresses = false;
+static std::vector<uint64_t> pressMicros[PressPipeline::MAX_CHANNELS];
+
+// Per-channel ISRs, generated the same way as on the device
+template <uint8_t CHANNEL>
+static void onChannelPulse()
+{
+  if (pipeline->onPulse(CHANNEL))
+  {
+    wakeRequested = true;
+    if (recordPresses)
+    {
+      pressMicros[CHANNEL].push_back(micros());
+    }
+  }
+}
+
+template <size_t... CHANNELS>
+static constexpr std::array<void (*)(), sizeof...(CHANNELS)> makeChannelIsrs(std::index_sequence<CHANNELS...>)
+{
+  return {{&onChannelPulse<CHANNELS>...}};
+}
+
+static const std::array<void (*)(), PressPipeline::MAX_CHANNELS> channelIsrs =
+    makeChannelIsrs(std::make_index_sequence<PressPipeline::MAX_CHANNELS>());
+
+// One pass of the firmware's loop(), each stage timed on its own
+static void runLoopPass(AsyncWebSocket &ws, HistoryReplay &replay, LogWriter &writer, StageTimes &times)
+{
+  unsigned long start = micros();
+  pipeline->capture();
+  for (PulseCounter *counter : pulseCounters)
+  {
+    if (counter)
+    {
+      counter->poll();
+    }
+  }
+  unsigned long captured = micros();
+  replay.pump();
+  unsigned long replayed = micros();
+  pipeline->process();
+  unsigned long processed = micros();
+  writer.poll();
+  unsigned long polled = micros();
+  ws.drain();
+  unsigned long delivered = micros();
+
+  times.capture += captured - start;
+  times.replay += replayed - captured;
+  times.process += processed - replayed;
+  times.poll += polled - processed;
+  times.delivery += delivered - polled;
+}
+
+// The soonest the device's tasks would wake on their own, the same
+// deadlines as the capture and persistence tasks wait for
+static unsigned long msUntilDue(HistoryReplay &replay, LogWriter &writer)
+{
+  unsigned long deadlines[] = {
+      IDLE_WAKE_MS,
+      pipeline->msUntilBatch(),
+      writer.msUntilFlush(),
+      replay.activeReplays() > 0 ? REPLAY_POLL_MS : ULONG_MAX};
+  unsigned long waitMs = ULONG_MAX;
+  for (unsigned long deadline : deadlines)
+  {
+    waitMs = deadline < waitMs ? deadline : waitMs;
+  }
+  for (PulseCounter *counter : pulseCounters)
+  {
+    if (counter && counter->msUntilHarvest() < waitMs)
+    {
+      waitMs = counter->msUntilHarvest();
+    }
+  }
+  return waitMs;
+}
+
+static bool sameRecord(const EventRecord &a, const EventRecord &b)
+{
+  return a.sequence == b.sequence && a.epochMillis == b.epochMillis && a.channel == b.channel && a.count == b.count;
+}
+
+// Every line shape a log has held, oldest first, written to a file and
+// read back through JsonLinesFormat as boot restore and replay read them.
+// A line longer than any of them is skipped whole, not decoded in pieces.
+static bool checkLegacyLines(fs::FS &filesystem)
+{
+  struct tm minute = {};
+  minute.tm_year = 2024 - 1900;
+  minute.tm_mon = 4;
+  minute.tm_mday = 1;
+  minute.tm_hour = 12;
+  minute.tm_isdst = -1;
+  int64_t minuteMillis = (int64_t)mktime(&minute) * 1000;
+
+  struct LegacyLine
+  {
+    std::string line;
+    EventRecord record; // Sequence 0 and channel 0 where the line has none
+  };
+  const LegacyLine lines[] = {
+      {"{\"buttonPressTimestamp\":\"2024-05-01 12:00:01\",\"buttonPressCount\":1}",
+       {minuteMillis + 1000, 0, 1, 0, 0}},
+      {"{\"buttonPressTimestamp\":\"2024-05-01 12:00:02.250\",\"buttonPressCount\":2}",
+       {minuteMillis + 2250, 0, 2, 0, 0}},
+      {"{\"seq\":2,\"buttonPressTimestamp\":\"2024-05-01 12:00:03.500\",\"buttonPressCount\":3}",
+       {minuteMillis + 3500, 2, 3, 0, 0}},
+      {"{\"seq\":4294967295,\"channel\":3,\"buttonPressTimestamp\":\"2024-05-01 12:00:04.750\","
+       "\"buttonPressCount\":4294967295}",
+       {minuteMillis + 4750, 4294967295u, 4294967295u, 3, 0}},
+      {"{\"seq\":5,\"channel\":1,\"ts\":" + std::to_string(minuteMillis + 5000) + ",\"count\":5}",
+       {minuteMillis + 5000, 5, 5, 1, 0}},
+  };
+  const size_t shapes = sizeof(lines) / sizeof(lines[0]);
+  std::string overlong = "{\"seq\":9,\"ts\":1,\"count\":9,\"padding\":\"" +
+                         std::string(EVENT_JSON_LINE_MAX_LENGTH, 'x') + "\",\"seq\":8,\"ts\":1,\"count\":8}";
+
+  File file = filesystem.open("/legacy.txt", FILE_WRITE);
+  for (size_t i = 0; i < shapes; i++)
+  {
+    // The overlong line goes in the middle, so a split would show up
+    std::string text = (i == 2 ? overlong + "\n" : "") + lines[i].line + "\n";
+    file.write((const uint8_t *)text.data(), text.size());
+  }
+  file.close();
+
+  JsonLinesFormat format;
+  file = filesystem.open("/legacy.txt", FILE_READ);
+  format.open(file);
+  size_t decoded = 0;
+  size_t matched = 0;
+  EventRecord record;
+  while (format.readNext(file, record))
+  {
+    matched += decoded < shapes && sameRecord(record, lines[decoded].record) ? 1 : 0;
+    decoded++;
+  }
+  file.close();
+  filesystem.remove("/legacy.txt");
+
+  Serial.printf("Legacy log lines: %u of %u shapes decoded as written, %u records read\n",
+                (unsigned)matched, (unsigned)shapes, (unsigned)decoded);
+  return matched == shapes && decoded == shapes;
+}
+
+// Encodes the logged records in batches as the pipeline would, both ways,
+// for the bytes each format puts on the wire and what it costs to build
+static void printFrameEncoding(const std::vector<EventRecord> &records, size_t batchSize)
+{
+  const int ROUNDS = 100;
+  std::vector<uint8_t> json(batchSize * (EVENT_JSON_MAX_LENGTH + 1) + 2);
+  std::vector<uint8_t> binary(EVENT_FRAME_HEADER_SIZE + batchSize * EVENT_FRAME_RECORD_MAX_SIZE);
+  size_t jsonBytes = 0;
+  size_t binaryBytes = 0;
+  unsigned long jsonMicros = 0;
+  unsigned long binaryMicros = 0;
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    unsigned long start = micros();
+    for (size_t at = 0; at < records.size(); at += batchSize)
+    {
+      size_t count = std::min(batchSize, records.size() - at);
+      jsonBytes += encodeEventJsonArray(&records[at], count, (char *)json.data());
+    }
+    unsigned long encoded = micros();
+    for (size_t at = 0; at < records.size(); at += batchSize)
+    {
+      size_t count = std::min(batchSize, records.size() - at);
+      binaryBytes += encodeEventFrame(&records[at], count, binary.data());
+    }
+    jsonMicros += encoded - start;
+    binaryMicros += micros() - encoded;
+  }
+
+  double encodings = (double)records.size() * ROUNDS;
+  if (encodings == 0)
+  {
+    return;
+  }
+  Serial.printf("Frames of %u records: JSON %.1f bytes %.1f ns per record, binary %.1f bytes %.1f ns per record\n",
+                (unsigned)batchSize, jsonBytes / encodings, jsonMicros * 1000.0 / encodings,
+                binaryBytes / encodings, binaryMicros * 1000.0 / encodings);
+}
+
+// Appends records one second apart on channel 0, ending now, each with
+// its sequence as the count. Calls atRecord after each, e.g. to note where
+// a checkpoint would be.
+static void fillLog(SegmentedLog &log, LogWriter &writer, unsigned long records,
+                    const std::function<void(const EventRecord &)> &atRecord = nullptr)
+{
+  int64_t firstMillis = hal::epochMicros() / 1000 - (int64_t)records * 1000;
+  for (uint32_t sequence = 1; sequence <= records; sequence++)
+  {
+    EventRecord record = {firstMillis + (int64_t)sequence * 1000, sequence, sequence, 0, 0};
+    log.append(record);
+    if (atRecord)
+    {
+      atRecord(record);
+    }
+  }
+  writer.sync();
+}
+
+// Sequences in a JSON array or a binary frame, as a client reads them
+static bool frameSequences(const uint8_t *data, size_t length, bool binary, std::vector<uint32_t> &sequences)
+{
+  if (binary)
+  {
+    EventRecord records[EVENT_FRAME_MAX_RECORDS];
+    size_t count = 0;
+    if (!decodeEventFrame(data, length, records, EVENT_FRAME_MAX_RECORDS, count))
+    {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+      sequences.push_back(records[i].sequence);
+    }
+    return true;
+  }
+  std::string frame((const char *)data, length);
+  for (size_t at = frame.find("\"seq\":"); at != std::string::npos; at = frame.find("\"seq\":", at + 1))
+  {
+    sequences.push_back(strtoul(frame.c_str() + at + 6, nullptr, 10));
+  }
+  return true;
+}
+
+// Paged replay of a long log: logRecords are appended before anyone
+// connects, then MAX_CLIENTS + 1 clients connect while presses keep coming
+// in and rates are pushed.
+//   fast      JSON, drained every pass
+//   slow      binary, one frame drained every slowPasses passes
+//   resume    JSON, connects with ?since= a sequence inside the window
+//   old       binary, connects with ?since= a sequence from before the window
+//   message   JSON, sends {"since":N} for the same sequence as resume once
+//             the replay has been pumped, as an older page does
+//   fill      JSON, fresh, taking the remaining sessions
+//   overflow  JSON, past MAX_CLIENTS, so no session and no history
+// A fresh client and one resuming too far back start at the segment
+// MAX_REPLAY_LOG_BYTES from the end. Every client has to end up with each
+// sequence from its start to the last logged one, once and in order, and
+// the slow client's queue never holds more than the replay lets it while
+// replays run. The message client drops what it already had, as the page
+// does; how much that was is reported. The overflow client has to get every
+// live record and every rate push, replays or not.
+static bool checkPagedReplay(const Options &options, SegmentedLog &log, LogWriter &writer,
+                             AsyncWebSocket &ws, HistoryReplay &replay)
+{
+  const unsigned long LIVE_PRESSES = 300;
+  const unsigned long LIVE_EVERY_PASSES = 20;
+  const unsigned long RESUME_BACK = 500;
+  const unsigned long RATES_EVERY_PASSES = 100;
+
+  hal::host::setSerialEnabled(false);
+  fillLog(log, writer, options.logRecords);
+  pipeline->restore(0, options.logRecords);
+  pipeline->restoreSequence(options.logRecords + 1);
+
+  size_t windowSegments = HistoryReplay::MAX_REPLAY_LOG_BYTES / log.maxSegmentSize();
+  size_t windowPosition = log.segmentCount() > windowSegments ? log.segmentCount() - windowSegments : 0;
+  uint32_t windowStart = log.segment(windowPosition).firstSequence;
+  uint32_t resumeAfter = options.logRecords > RESUME_BACK ? options.logRecords - RESUME_BACK : 0;
+
+  enum class Resume
+  {
+    None,
+    Query,
+    Message
+  };
+  struct ReplayClient
+  {
+    const char *name;
+    bool binary;
+    Resume resume;
+    uint32_t since;
+    uint32_t firstExpected;
+    uint32_t id;
+  };
+  ReplayClient clients[] = {
+      {"fast", false, Resume::None, 0, 0, 0},
+      {"slow", true, Resume::None, 0, 0, 0},
+      {"resume", false, Resume::Query, resumeAfter, 0, 0},
+      {"old", true, Resume::Query, 1, 0, 0},
+      {"message", false, Resume::Message, resumeAfter, 0, 0},
+      {"fill", false, Resume::None, 0, 0, 0},
+      {"fill", false, Resume::None, 0, 0, 0},
+      {"fill", false, Resume::None, 0, 0, 0},
+      {"overflow", false, Resume::None, 0, 0, 0},
+  };
+  const size_t SLOW = 1;
+  const size_t MESSAGE = 4;
+  const size_t OVERFLOW = 8;
+  static_assert(sizeof(clients) / sizeof(clients[0]) == HistoryReplay::MAX_CLIENTS + 1,
+                "One client more than the replay has sessions for");
+
+  std::map<uint32_t, std::vector<uint32_t>> sequences;
+  std::map<uint32_t, unsigned long> undecodable;
+  std::map<uint32_t, unsigned long> ratePushes;
+  const std::string RATES_FRAME = "{\"rates\":[]}";
+  ws.setSink([&](AsyncWebSocketClient &client, const uint8_t *data, size_t length, bool binary)
+             {
+               if (!binary && std::string((const char *)data, length) == RATES_FRAME)
+               {
+                 ratePushes[client.id()]++;
+                 return;
+               }
+               if (!frameSequences(data, length, binary, sequences[client.id()]))
+               {
+                 undecodable[client.id()]++;
+               } });
+  for (ReplayClient &client : clients)
+  {
+    // Resuming further back than the window gets the window
+    client.firstExpected = client.resume != Resume::None ? std::max(client.since + 1, windowStart) : windowStart;
+    client.id = ws.connect().id();
+    if (client.resume == Resume::Query)
+    {
+      replay.clientConnected(client.id, client.binary, client.since);
+    }
+    else
+    {
+      replay.clientConnected(client.id, client.binary);
+    }
+  }
+  // Only live records reach the client without a session
+  clients[OVERFLOW].firstExpected = options.logRecords + 1;
+
+  // Live presses arrive while the replays page through the log and after,
+  // so every client has to hand over from its cursor to live frames
+  size_t maxSlowQueue = 0;
+  unsigned long ratesPushed = 0;
+  unsigned long livePresses = 0;
+  unsigned long passes = 0;
+  bool settled = false;
+  while (!settled && passes < 10000000)
+  {
+    if (livePresses < LIVE_PRESSES && passes % LIVE_EVERY_PASSES == 0)
+    {
+      pipeline->injectPulse(micros());
+      livePresses++;
+    }
+    if (livePresses < LIVE_PRESSES && passes % RATES_EVERY_PASSES == 0)
+    {
+      // As pushRates() does on the device
+      replay.broadcast(std::make_shared<std::vector<uint8_t>>(RATES_FRAME.begin(), RATES_FRAME.end()));
+      ratesPushed++;
+    }
+    pipeline->capture();
+    replay.pump();
+    if (passes == 0)
+    {
+      // The message arrives after the Connected event has been pumped
+      replay.clientRequestedSince(clients[MESSAGE].id, clients[MESSAGE].since);
+    }
+    pipeline->process();
+    writer.poll();
+    if (replay.activeReplays() > 0)
+    {
+      maxSlowQueue = std::max(maxSlowQueue, ws.client(clients[SLOW].id)->queueLen());
+    }
+    for (const ReplayClient &client : clients)
+    {
+      if (&client != &clients[SLOW])
+      {
+        ws.drain(client.id, SIZE_MAX);
+      }
+    }
+    if (passes % options.slowPasses == 0)
+    {
+      ws.drain(clients[SLOW].id, 1);
+    }
+    hal::host::advanceClock(options.loopMicros);
+    passes++;
+
+    bool queuesEmpty = true;
+    for (AsyncWebSocketClient &client : ws.getClients())
+    {
+      queuesEmpty = queuesEmpty && client.queueLen() == 0;
+    }
+    settled = livePresses == LIVE_PRESSES && pipeline->msUntilBatch() == ULONG_MAX &&
+              replay.activeReplays() == 0 && queuesEmpty;
+  }
+  writer.sync();
+  hal::host::setSerialEnabled(true);
+
+  uint32_t lastSequence = pipeline->nextSequence() - 1;
+  Serial.printf("Replay: %lu records logged before connecting, %lu live presses, %lu segments, "
+                "window from sequence %lu at segment %u, %lu passes\n",
+                options.logRecords, livePresses, (unsigned long)log.segmentCount(),
+                (unsigned long)windowStart, (unsigned)windowPosition, passes);
+
+  bool complete = settled;
+  for (const ReplayClient &client : clients)
+  {
+    std::vector<uint32_t> got;
+    size_t alreadyHad = 0;
+    for (uint32_t sequence : sequences[client.id])
+    {
+      if (client.resume == Resume::Message && sequence <= client.since)
+      {
+        alreadyHad++;
+        continue;
+      }
+      got.push_back(sequence);
+    }
+    size_t inOrder = 0;
+    while (inOrder < got.size() && got[inOrder] == client.firstExpected + inOrder)
+    {
+      inOrder++;
+    }
+    size_t expected = lastSequence >= client.firstExpected ? lastSequence - client.firstExpected + 1 : 0;
+    AsyncWebSocketClient *socket = ws.client(client.id);
+    bool clientComplete = inOrder == expected && got.size() == expected &&
+                          undecodable[client.id] == 0 && socket->framesDropped == 0;
+    Serial.printf("Replay client %s (%s): %lu records from %lu expected, %lu received, %lu in order, "
+                  "%lu already had, %lu frames, %lu dropped, %lu undecodable%s\n",
+                  client.name, client.binary ? "binary" : "JSON", (unsigned long)expected,
+                  (unsigned long)client.firstExpected, (unsigned long)got.size(), (unsigned long)inOrder,
+                  (unsigned long)alreadyHad,
+                  (unsigned long)socket->framesReceived, (unsigned long)socket->framesDropped,
+                  undecodable[client.id], clientComplete ? "" : " INCOMPLETE");
+    complete = complete && clientComplete;
+  }
+  Serial.printf("Replay slow client: at most %lu frames queued during replay, %u allowed\n",
+                (unsigned long)maxSlowQueue, (unsigned)HistoryReplay::MAX_QUEUED_MESSAGES);
+  unsigned long overflowRates = ratePushes[clients[OVERFLOW].id];
+  Serial.printf("Replay overflow client: %lu of %lu rate pushes\n", overflowRates, ratesPushed);
+  return complete && maxSlowQueue <= HistoryReplay::MAX_QUEUED_MESSAGES && overflowRates == ratesPushed;
+}
+
+// Boot restore from a log of logRecords records, which retention trims to
+// about 1 MB, timed in real time. Channel 0 has every record; channel 1 was
+// never pressed, so its scan reads everything after the checkpoint. Three
+// checkpoints: one written 60 records before the end, none at all (a first
+// boot after an update, or a lost NVS), and one whose reserved sequence
+// limit is ahead of the log. Each has to restore the last count and the
+// next sequence.
+static bool checkRestore(const Options &options, SegmentedLog &log, LogWriter &writer, HistoryReplay &replay)
+{
+  const int ROUNDS = 5;
+  const unsigned long CHECKPOINT_BACK = 60;
+
+  CountCheckpoint recent = {};
+  hal::host::setSerialEnabled(false);
+  fillLog(log, writer, options.logRecords, [&](const EventRecord &record)
+          {
+            if (record.sequence + CHECKPOINT_BACK == options.logRecords)
+            {
+              // What saveCheckpoint() stores, right after a flush
+              writer.sync();
+              recent = {log.currentSegment(), writer.size(), record.sequence + 1, 0, {record.count, 0}};
+            } });
+  hal::host::setSerialEnabled(true);
+
+  size_t logBytes = 0;
+  for (size_t i = 0; i < log.segmentCount(); i++)
+  {
+    char path[LogWriter::MAX_PATH_LENGTH];
+    log.segmentPath(log.segment(i).index, path, sizeof(path));
+    File file = log.fileSystem().open(path, FILE_READ);
+    logBytes += file ? file.size() : 0;
+    file.close();
+  }
+  Serial.printf("Restore: %lu records logged, %lu bytes in %lu segments\n",
+                options.logRecords, (unsigned long)logBytes, (unsigned long)log.segmentCount());
+
+  struct RestoreCase
+  {
+    const char *name;
+    CountCheckpoint checkpoint;
+    uint32_t nextSequence;
+  };
+  CountCheckpoint none = {};
+  CountCheckpoint ahead = recent;
+  ahead.sequenceLimit = options.logRecords + 1000;
+  const RestoreCase cases[] = {
+      {"recent checkpoint", recent, (uint32_t)options.logRecords + 1},
+      {"no checkpoint", none, (uint32_t)options.logRecords + 1},
+      {"sequence limit ahead", ahead, ahead.sequenceLimit},
+  };
+
+  bool complete = true;
+  for (const RestoreCase &restoreCase : cases)
+  {
+    unsigned long fastest = ULONG_MAX;
+    unsigned long total = 0;
+    bool restored = true;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+      PressPipeline booted(log, replay, 2);
+      unsigned long start = micros();
+      restoreCounts(booted, log, restoreCase.checkpoint);
+      unsigned long elapsed = micros() - start;
+      fastest = std::min(fastest, elapsed);
+      total += elapsed;
+      restored = restored && booted.count(0) == options.logRecords && booted.count(1) == 0 &&
+                 booted.nextSequence() == restoreCase.nextSequence;
+    }
+    Serial.printf("Restore %s (segment %lu, %lu bytes): %lu us fastest, %lu us mean of %d%s\n",
+                  restoreCase.name, (unsigned long)restoreCase.checkpoint.segment,
+                  (unsigned long)restoreCase.checkpoint.offset, fastest, total / ROUNDS, ROUNDS,
+                  restored ? "" : ", WRONG counts or sequence");
+    complete = complete && restored;
+  }
+  return complete;
+}
+
+// The capture-to-broadcast path before the EventRecord pool, on the
+// constant train: every press queued a heap string with its formatted
+// time, and every pass popped them, built the JSON frame in another
+// string, sent it to every client and appended it to the log through
+// open, write, close. std::string stands in for String. The JsonDocument
+// the firmware built the frame in allocated as well and isn't modelled,
+// so the figures are a floor.
+static bool checkStringQueue(const Options &options, fs::FS &filesystem)
+{
+  AsyncWebSocket ws("/ws");
+  for (unsigned long i = 0; i < options.clients; i++)
+  {
+    ws.connect();
+  }
+  PulseTrain train = constantTrain(options.presses, (uint64_t)options.periodMs * 1000);
+  std::queue<std::string> buttonLog;
+  unsigned long count = 0;
+
+  hal::host::resetHeapHighWater();
+  size_t heapBaseline = hal::host::heapInUse();
+  size_t allocationsBaseline = hal::host::heapAllocationCount();
+  uint64_t start = micros();
+  uint64_t end = train.edges.back().atMicros + options.loopMicros;
+  size_t nextEdge = 0;
+  for (uint64_t passAt = 0; passAt <= end; passAt += options.loopMicros)
+  {
+    hal::host::advanceClock(start + passAt - micros());
+    for (; nextEdge < train.edges.size() && train.edges[nextEdge].atMicros <= passAt; nextEdge++)
+    {
+      if (train.edges[nextEdge].level == LOW)
+      {
+        time_t epoch = (time_t)(hal::epochMillis() / 1000);
+        struct tm timeinfo;
+        localtime_r(&epoch, &timeinfo);
+        char timestamp[64];
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        buttonLog.push(std::string(timestamp));
+        count++;
+      }
+    }
+
+    while (!buttonLog.empty())
+    {
+      std::string buttonPressTimestamp = buttonLog.front();
+      buttonLog.pop();
+      std::string line = "Pulse time - Fifo: " + buttonPressTimestamp;
+      std::string jsonString = "{\"buttonPressTimestamp\":\"" + buttonPressTimestamp +
+                               "\",\"buttonPressCount\":" + std::to_string(count) + "}";
+      ws.textAll(jsonString.data(), jsonString.size());
+      File file = filesystem.open("/ButtonLog.txt", FILE_APPEND);
+      file.write((const uint8_t *)jsonString.data(), jsonString.size());
+      file.write((const uint8_t *)"\n", 1);
+      file.close();
+    }
+    ws.drain();
+  }
+  size_t allocations = hal::host::heapAllocationCount() - allocationsBaseline;
+
+  Serial.printf("String queue: %lu presses, %lu clients\n", count, options.clients);
+  Serial.printf("Heap high-water %lu bytes above the %lu at start\n",
+                (unsigned long)(hal::host::heapHighWater() - heapBaseline), (unsigned long)heapBaseline);
+  Serial.printf("Heap allocations %lu, %.2f per press\n", (unsigned long)allocations, (double)allocations / count);
+  return count == options.presses;
+}
+
+// The per-client copy and the shared buffer for options.clients loopback
+// clients, drained after every round. With two clients or more the shared
+// frame has to hold less heap than two copies of it.
+static bool checkBroadcast(const Options &options)
+{
+  AsyncWebSocket ws("/ws");
+  for (unsigned long i = 0; i < options.clients; i++)
+  {
+    ws.connect();
+  }
+  BroadcastCost cost = measureBroadcast(ws, options.rounds, [&ws]()
+                                        { ws.drain(); });
+  Serial.printf("Broadcast, %lu clients, %lu byte frame: copy %.2f us %ld bytes, shared %.2f us %ld bytes, "
+                "mean of %lu\n",
+                (unsigned long)cost.clients, (unsigned long)cost.frameBytes, cost.copyMicros, (long)cost.copyHeap,
+                cost.sharedMicros, (long)cost.sharedHeap, options.rounds);
+  return cost.clients < 2 || cost.sharedHeap < (int32_t)(2 * cost.frameBytes);
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+  struct NumericOption
+  {
+    const char *name;
+    unsigned long *value;
+  };
+  const NumericOption numeric[] = {
+      {"--presses", &options.presses},
+      {"--period", &options.periodMs},
+      {"--burst", &options.burst},
+      {"--gap", &options.gapMs},
+      {"--bounces", &options.bounces},
+      {"--clients", &options.clients},
+      {"--binary-clients", &options.binaryClients},
+      {"--channels", &options.channels},
+      {"--loop-us", &options.loopMicros},
+      {"--seed", &options.seed},
+      {"--step-ms", &options.stepMs},
+      {"--rounds", &options.rounds},
+      {"--drain-us", &options.drainMicros},
+      {"--ring-rate", &options.ringRate},
+      {"--log-records", &options.logRecords},
+      {"--slow-passes", &options.slowPasses},
+      {"--batch-size", &options.batchSize},
+      {"--batch-window", &options.batchWindowMs},
+      {"--filter-ns", &options.filterNanos},
+      {"--harvest-ms", &options.harvestMs},
+      {"--ntp-delay-ms", &options.ntpDelayMs},
+      {"--ntp-drops", &options.ntpDrops},
+      {"--ntp-resync-ms", &options.ntpResyncMs},
+      {"--drift-ppm", &options.driftPpm},
+  };
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--binary") == 0)
+    {
+      options.binary = true;
+      continue;
+    }
+    if (strcmp(arg, "--profile") == 0)
+    {
+      options.profile = true;
+      continue;
+    }
+    if (strcmp(arg, "--pcnt") == 0)
+    {
+      options.pcnt = true;
+      continue;
+    }
+    if (strcmp(arg, "--wake") == 0)
+    {
+      options.wake = true;
+      continue;
+    }
+    if (strcmp(arg, "--ntp") == 0)
+    {
+      options.ntp = true;
+      continue;
+    }
+    if (arg[0] != '-')
+    {
+      options.train = arg;
+      continue;
+    }
+
+    bool known = false;
+    for (const NumericOption &option : numeric)
+    {
+      if (strcmp(arg, option.name) == 0 && i + 1 < argc)
+      {
+        *option.value = strtoul(argv[++i], nullptr, 10);
+        known = true;
+      }
+    }
+    if (!known)
+    {
+      return false;
+    }
+  }
+  return options.burst > 0 && options.loopMicros > 0 && options.slowPasses > 0 && options.rounds > 0 &&
+         (options.batchSize == ULONG_MAX || (options.batchSize > 0 && options.batchSize <= PressPipeline::MAX_BATCH_SIZE)) &&
+         options.channels > 0 && options.channels <= PressPipeline::MAX_CHANNELS;
+}
+
+static bool makeTrain(const Options &options, uint32_t seed, PulseTrain &train)
+{
+  uint64_t period = (uint64_t)options.periodMs * 1000;
+  if (strcmp(options.train, "constant") == 0)
+  {
+    train = constantTrain(options.presses, period);
+  }
+  else if (strcmp(options.train, "poisson") == 0)
+  {
+    train = poissonTrain(options.presses, period, seed);
+  }
+  else if (strcmp(options.train, "bursty") == 0)
+  {
+    train = burstyTrain(options.presses, options.burst, period, (uint64_t)options.gapMs * 1000);
+  }
+  else if (strcmp(options.train, "chatter") == 0)
+  {
+    train = chatterTrain(options.presses, period, options.bounces, 5000, seed);
+  }
+  else
+  {
+    return loadPulseTrain(options.train, train);
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  bool parsed = parseOptions(argc, argv, options);
+  bool benchmark = parsed && strcmp(options.train, "benchmark") == 0;
+  bool pagedReplay = parsed && strcmp(options.train, "replay") == 0;
+  bool restore = parsed && strcmp(options.train, "restore") == 0;
+  if (parsed && strcmp(options.train, "ring") == 0)
+  {
+    return runRingStress({options.stepMs, options.drainMicros, options.ringRate, 10000000}) ? 0 : 1;
+  }
+  if (parsed && strcmp(options.train, "broadcast") == 0)
+  {
+    hal::host::setRealTimeEnabled(true);
+    return checkBroadcast(options) ? 0 : 1;
+  }
+  if (parsed && strcmp(options.train, "string-queue") == 0)
+  {
+    std::string root = hal::host::makeTempDirectory("button-log-");
+    fs::FS filesystem(root);
+    bool complete = checkStringQueue(options, filesystem);
+    hal::host::removeDirectory(root);
+    return complete ? 0 : 1;
+  }
+
+  // Every channel gets its own seed, and constant trains are spread out
+  // over the period so the channels don't fire at the same instant
+  std::vector<ChannelEdge> edges;
+  unsigned long presses = 0;
+  for (unsigned long channel = 0; parsed && !benchmark && !pagedReplay && !restore && channel < options.channels; channel++)
+  {
+    PulseTrain train;
+    if (!makeTrain(options, options.seed + channel, train) || train.presses == 0)
+    {
+      parsed = false;
+      break;
+    }
+    uint64_t offset = (uint64_t)options.periodMs * 1000 * channel / options.channels;
+    for (const PulseEdge &edge : train.edges)
+    {
+      edges.push_back({edge.atMicros + offset, (uint8_t)channel, edge.level});
+    }
+    presses += train.presses;
+  }
+  std::stable_sort(edges.begin(), edges.end(), [](const ChannelEdge &a, const ChannelEdge &b)
+                   { return a.atMicros < b.atMicros; });
+
+  if (!parsed)
+  {
+    Serial.printf("Usage: %s [constant|poisson|bursty|chatter|<file>|benchmark|ring|replay|restore|broadcast|string-queue] [--presses N] "
+                  "[--period MS] [--burst N] [--gap MS] [--bounces N] [--clients N] [--binary-clients N] [--channels N] "
+                  "[--loop-us N] "
+                  "[--seed N] [--binary] [--profile] [--step-ms N] [--pcnt] [--filter-ns N] "
+                  "[--harvest-ms N] [--wake] [--ntp] [--ntp-delay-ms N] [--ntp-drops N] [--ntp-resync-ms N] "
+                  "[--drift-ppm N] [--drain-us N] [--ring-rate N] [--log-records N] [--slow-passes N] "
+                  "[--batch-size N] [--batch-window MS] [--rounds N]\n",
+                  argv[0]);
+    return 2;
+  }
+  hal::host::setRealTimeEnabled(options.profile || benchmark || restore);
+
+  std::string root = hal::host::makeTempDirectory("button-log-");
+  fs::FS filesystem(root);
+  bool legacyLinesRead = benchmark || restore || checkLegacyLines(filesystem);
+
+  JsonLinesFormat jsonLinesFormat;
+  BinaryLogFormat binaryLogFormat;
+  const EventLogFormat &format = options.binary ? (const EventLogFormat &)binaryLogFormat : jsonLinesFormat;
+  LogWriter writer(filesystem, "/ButtonLog.txt", format, FlushPolicy::Interval, 1000);
+  SegmentedLog log(filesystem, "/log", format, writer, 64 * 1024, {1024 * 1024, 365UL * 24 * 3600});
+  AsyncWebSocket ws("/ws");
+  HistoryReplay replay(ws, log, writer);
+  size_t channels = benchmark || pagedReplay || restore ? 1 : options.channels;
+  PressPipeline pressPipeline(log, replay, channels);
+  pipeline = &pressPipeline;
+  pressPipeline.setBatching(options.batchSize != ULONG_MAX ? options.batchSize : pressPipeline.batching().maxSize,
+                            options.batchWindowMs != ULONG_MAX ? options.batchWindowMs : pressPipeline.batching().windowMs);
+  RateEngine rates(channels);
+  pressPipeline.setRateEngine(&rates);
+  const RollupRetention rollupRetention = {2 * 24 * 60, 90 * 24, 3 * 366};
+  RollupStore rollups(filesystem, "/rollup", channels, rollupRetention);
+  pressPipeline.setRollupStore(&rollups);
+
+  // With --ntp the device boots with the clock unset and counts from the
+  // start; the stand-in sets the clock once it answers
+  NtpStandIn ntp({(uint64_t)options.ntpDelayMs * 1000, options.ntpDrops, 15000000,
+                  (uint64_t)options.ntpResyncMs * 1000, options.driftPpm});
+  ClockSync clockSync;
+  if (options.ntp)
+  {
+    hal::host::setEpochMillisAtStart(0);
+    recordPresses = true;
+    for (uint8_t channel = 0; channel < channels; channel++)
+    {
+      pressMicros[channel].reserve(presses);
+    }
+  }
+
+  log.begin(nullptr);
+  rollups.begin(log);
+  std::vector<std::unique_ptr<PulseCounter>> counters;
+  for (uint8_t channel = 0; channel < channels; channel++)
+  {
+    uint8_t pin = BUTTON_PIN + channel;
+    if (options.pcnt)
+    {
+      counters.emplace_back(new PulseCounter(pressPipeline, channel, channel, pin, options.filterNanos, options.harvestMs));
+      counters.back()->begin();
+      pulseCounters[channel] = counters.back().get();
+    }
+    else
+    {
+      pinMode(pin, INPUT_PULLUP);
+      attachInterrupt(pin, channelIsrs[channel], FALLING);
+    }
+  }
+
+  if (benchmark)
+  {
+    for (unsigned long i = 0; i < options.clients; i++)
+    {
+      ws.connect();
+    }
+    ThroughputBenchmark throughput(pressPipeline, replay, writer, ws);
+    throughput.setDelivery([&ws]()
+                           { ws.drain(); });
+    throughput.run(options.stepMs);
+    writer.close();
+    hal::host::removeDirectory(root);
+    return 0;
+  }
+
+  if (pagedReplay)
+  {
+    hal::host::advanceClock((PressPipeline::DEBOUNCE_DELAY + 1) * 1000);
+    bool complete = legacyLinesRead && checkPagedReplay(options, log, writer, ws, replay);
+    writer.close();
+    hal::host::removeDirectory(root);
+    return complete ? 0 : 1;
+  }
+
+  if (restore)
+  {
+    bool complete = checkRestore(options, log, writer, replay);
+    writer.close();
+    hal::host::removeDirectory(root);
+    return complete ? 0 : 1;
+  }
+
+  // Records each client got, live or replayed, and what binary clients decoded
+  std::map<uint32_t, unsigned long> received;
+  std::map<uint32_t, std::vector<EventRecord>> decoded;
+  std::map<uint32_t, unsigned long> undecodable;
+  ws.setSink([&](AsyncWebSocketClient &client, const uint8_t *data, size_t length, bool binary)
+             {
+               if (binary)
+               {
+                 EventRecord records[EVENT_FRAME_MAX_RECORDS];
+                 size_t count = 0;
+                 if (!decodeEventFrame(data, length, records, EVENT_FRAME_MAX_RECORDS, count))
+                 {
+                   undecodable[client.id()]++;
+                   return;
+                 }
+                 received[client.id()] += count;
+                 decoded[client.id()].insert(decoded[client.id()].end(), records, records + count);
+                 return;
+               }
+               // Scanned in place, so the sink adds nothing to the heap figures
+               static const char SEQ_KEY[] = "\"seq\":";
+               const uint8_t *frameEnd = data + length;
+               for (const uint8_t *at = std::search(data, frameEnd, SEQ_KEY, SEQ_KEY + sizeof(SEQ_KEY) - 1);
+                    at != frameEnd; at = std::search(at + 1, frameEnd, SEQ_KEY, SEQ_KEY + sizeof(SEQ_KEY) - 1))
+               {
+                 received[client.id()]++;
+               } });
+  for (unsigned long i = 0; i < options.clients; i++)
+  {
+    uint32_t id = ws.connect().id();
+    replay.clientConnected(id, i < options.binaryClients);
+    // Room for every record up front, so the heap figure is the firmware's
+    received[id] = 0;
+    if (i < options.binaryClients)
+    {
+      decoded[id].reserve(presses);
+    }
+  }
+
+  // The device is never pressed within the debounce delay of boot
+  hal::host::advanceClock((PressPipeline::DEBOUNCE_DELAY + 1) * 1000);
+  uint64_t trainStart = micros();
+  hal::host::resetHeapHighWater();
+  size_t heapBaseline = hal::host::heapInUse();
+  size_t allocationsBaseline = hal::host::heapAllocationCount();
+
+  // Edges and NTP traffic happen at their own time, loop() passes every
+  // loopMicros in between, or with --wake right after an accepted pulse or
+  // an NTP answer and whenever a deadline is due. After the last edge the
+  // batch window and flush interval run out.
+  hal::host::setSerialEnabled(false);
+  StageTimes times = {};
+  unsigned long passes = 0;
+  uint64_t settleMicros = (pressPipeline.batching().windowMs + writer.interval()) * 1000 + options.loopMicros;
+  if (options.pcnt)
+  {
+    settleMicros += options.harvestMs * 1000;
+  }
+  uint64_t end = edges.back().atMicros + settleMicros;
+  uint64_t passAt = 0;
+  size_t nextEdge = 0;
+  while (passAt <= end)
+  {
+    uint64_t edgeAt = nextEdge < edges.size() ? edges[nextEdge].atMicros : UINT64_MAX;
+    uint64_t ntpAt = UINT64_MAX;
+    if (options.ntp)
+    {
+      ntpAt = ntp.nextEventMicros() > trainStart ? ntp.nextEventMicros() - trainStart : 0;
+    }
+    bool ntpFirst = ntpAt < passAt && ntpAt <= edgeAt;
+    bool edgeFirst = !ntpFirst && edgeAt < passAt;
+    uint64_t at = ntpFirst ? ntpAt : edgeFirst ? edgeAt : passAt;
+    uint64_t now = micros() - trainStart;
+    if (at > now)
+    {
+      hal::host::advanceClock(at - now);
+    }
+
+    int64_t ntpEpochMicros;
+    if (ntpFirst)
+    {
+      // What the SNTP callback does on the device
+      if (ntp.fire(ntpEpochMicros))
+      {
+        clockSync.onSync(micros(), ntpEpochMicros, hal::epochMicros());
+        hal::host::setEpochMicros(ntpEpochMicros);
+        passAt = options.wake ? at : passAt;
+      }
+    }
+    else if (edgeFirst)
+    {
+      const ChannelEdge &edge = edges[nextEdge++];
+      hal::host::setPin(BUTTON_PIN + edge.channel, edge.level ? HIGH : LOW);
+      if (options.wake && wakeRequested)
+      {
+        passAt = edge.atMicros;
+      }
+    }
+    else
+    {
+      wakeRequested = false;
+      runLoopPass(ws, replay, writer, times);
+      passes++;
+      passAt = options.wake ? passAt + msUntilDue(replay, writer) * 1000 : passAt + options.loopMicros;
+    }
+  }
+  writer.sync();
+  hal::host::setSerialEnabled(true);
+  // Before the log is read back for checking
+  size_t heapHighWater = hal::host::heapHighWater();
+  size_t allocations = hal::host::heapAllocationCount() - allocationsBaseline;
+
+  // Rates as of the last edge, before the settle time decays them
+  char ratesJson[RateEngine::JSON_MAX_LENGTH];
+  rates.encodeJson(ratesJson, sizeof(ratesJson), trainStart + edges.back().atMicros,
+                   (uint32_t)(pressPipeline.toEpochMicros(trainStart + edges.back().atMicros) / 1000000));
+
+  // Records and last count per channel
+  unsigned long logged = 0;
+  unsigned long channelRecords[PressPipeline::MAX_CHANNELS] = {};
+  unsigned long lastLoggedCounts[PressPipeline::MAX_CHANNELS] = {};
+  std::vector<EventRecord> logRecords;
+  LogCursor cursor(log);
+  cursor.seekSegment(0);
+  EventRecord record;
+  // The held records --ntp backfills have to land before the ones after them
+  unsigned long outOfOrder = 0;
+  while (cursor.next(record))
+  {
+    outOfOrder += !logRecords.empty() && record.sequence <= logRecords.back().sequence ? 1 : 0;
+    logged++;
+    logRecords.push_back(record);
+    if (record.channel < channels)
+    {
+      channelRecords[record.channel]++;
+      lastLoggedCounts[record.channel] = record.count;
+    }
+  }
+  cursor.close();
+
+  unsigned long counted = 0;
+  bool complete = legacyLinesRead;
+  for (uint8_t channel = 0; channel < channels; channel++)
+  {
+    unsigned long channelCounted = pressPipeline.count(channel);
+    counted += channelCounted;
+    complete = complete && lastLoggedCounts[channel] == channelCounted &&
+               (options.pcnt || channelRecords[channel] == channelCounted);
+  }
+  Serial.printf("%s: %lu presses injected in %lu edges, %lu counted, %lu logged (%s), %lu segments\n",
+                options.train, presses, (unsigned long)edges.size(), counted, logged,
+                options.binary ? "binary" : "JSON lines", (unsigned long)log.segmentCount());
+  if (outOfOrder > 0)
+  {
+    Serial.printf("%lu records logged out of sequence order\n", outOfOrder);
+    complete = false;
+  }
+  for (uint8_t channel = 0; channel < channels && (channels > 1 || options.pcnt); channel++)
+  {
+    Serial.printf("Channel %u: %lu counted, %lu records, last logged count %lu",
+                  (unsigned)channel, pressPipeline.count(channel), channelRecords[channel],
+                  lastLoggedCounts[channel]);
+    if (pulseCounters[channel])
+    {
+      Serial.printf(", %lu harvests", (unsigned long)pulseCounters[channel]->harvests());
+    }
+    Serial.println();
+  }
+  for (AsyncWebSocketClient &client : ws.getClients())
+  {
+    Serial.printf("Client %lu: %lu records in %lu frames, %lu bytes, %lu dropped\n",
+                  (unsigned long)client.id(), received[client.id()],
+                  (unsigned long)client.framesReceived, (unsigned long)client.bytesReceived,
+                  (unsigned long)client.framesDropped);
+    complete = complete && received[client.id()] == logged;
+  }
+
+  // Binary clients see the same records, field for field, as the log
+  for (const auto &client : decoded)
+  {
+    unsigned long mismatched = 0;
+    for (size_t i = 0; i < client.second.size(); i++)
+    {
+      mismatched += i < logRecords.size() && sameRecord(client.second[i], logRecords[i]) ? 0 : 1;
+    }
+    if (mismatched > 0 || undecodable[client.first] > 0)
+    {
+      Serial.printf("Client %lu: %lu binary records differ from the log, %lu frames undecodable\n",
+                    (unsigned long)client.first, mismatched, undecodable[client.first]);
+      complete = false;
+    }
+  }
+
+  Serial.printf("%s\n", ratesJson);
+
+  if (options.ntp)
+  {
+    // The n-th record of a channel is its n-th accepted press, unless some
+    // presses found no room while the clock was unset
+    const ClockSyncStats &sync = clockSync.stats();
+    unsigned long unset = 0;
+    unsigned long compared = 0;
+    int64_t maxErrorMicros = 0;
+    size_t nth[PressPipeline::MAX_CHANNELS] = {};
+    LogCursor stamps(log);
+    stamps.seekSegment(0);
+    while (stamps.next(record))
+    {
+      int64_t stampMicros = record.epochMillis * 1000;
+      unset += wallClockSet(stampMicros) ? 0 : 1;
+      if (options.pcnt || pressPipeline.unheldRecords() > 0 || record.channel >= channels ||
+          nth[record.channel] >= pressMicros[record.channel].size())
+      {
+        continue;
+      }
+      int64_t error = stampMicros - ntp.epochMicrosAt(pressMicros[record.channel][nth[record.channel]++]);
+      error = error < 0 ? -error : error;
+      maxErrorMicros = error > maxErrorMicros ? error : maxErrorMicros;
+      compared++;
+    }
+    stamps.close();
+    complete = complete && unset == 0 && pressPipeline.heldRecords() == 0;
+
+    Serial.printf("NTP stand-in: %lu requests, %lu answers, clock set %lu ms after boot, "
+                  "last error %.3f ms, drift %.1f ppm\n",
+                  ntp.requests(), ntp.answers(), (unsigned long)(sync.firstSyncMicros / 1000),
+                  sync.lastErrorMicros / 1000.0, sync.driftPpm);
+    Serial.printf("%lu records backfilled, %lu without room, %lu still held, %lu stamped before the clock was set; "
+                  "max %.3f ms off the stand-in's clock over %lu presses\n",
+                  (unsigned long)pressPipeline.backfilledRecords(), (unsigned long)pressPipeline.unheldRecords(),
+                  (unsigned long)pressPipeline.heldRecords(), unset, maxErrorMicros / 1000.0, compared);
+  }
+
+  // Every resolution has to add up to the counts, live, after a restart
+  // from the saved state and after a rebuild from the log
+  auto rollupsMatch = [&](RollupStore &store, const char *when)
+  {
+    bool match = true;
+    for (size_t i = 0; i < RollupStore::RESOLUTIONS; i++)
+    {
+      RollupResolution resolution = (RollupResolution)i;
+      unsigned long totals[PressPipeline::MAX_CHANNELS] = {};
+      unsigned long buckets = 0;
+      store.read(resolution, 0, UINT32_MAX, SIZE_MAX, [&](const RollupBucket &bucket)
+                 {
+        buckets++;
+        for (size_t channel = 0; channel < channels; channel++)
+        {
+          totals[channel] += bucket.pulses[channel];
+        } });
+      for (uint8_t channel = 0; channel < channels; channel++)
+      {
+        match = match && totals[channel] == pressPipeline.count(channel);
+      }
+      Serial.printf("%s%lu %s buckets", i == 0 ? "" : ", ", buckets, RollupStore::resolutionName(resolution));
+    }
+    Serial.printf(" %s, totals %s\n", when, match ? "match" : "DO NOT match");
+    return match;
+  };
+  complete = rollupsMatch(rollups, "live") && complete;
+  {
+    RollupStore restarted(filesystem, "/rollup", channels, rollupRetention);
+    hal::host::setSerialEnabled(false);
+    restarted.begin(log);
+    hal::host::setSerialEnabled(true);
+    complete = rollupsMatch(restarted, "after restart") && complete;
+  }
+  {
+    filesystem.remove("/rollup/state");
+    RollupStore rebuilt(filesystem, "/rollup", channels, rollupRetention);
+    hal::host::setSerialEnabled(false);
+    rebuilt.begin(log);
+    hal::host::setSerialEnabled(true);
+    complete = rollupsMatch(rebuilt, "after rebuild") && complete;
+  }
+
+  const LatencyHistogram &latency = pressPipeline.latency();
+  Serial.printf("Latency press to broadcast: p50 %lu ms, p90 %lu ms, p99 %lu ms, max %lu ms\n",
+                (unsigned long)latency.percentile(0.5f), (unsigned long)latency.percentile(0.9f),
+                (unsigned long)latency.percentile(0.99f), (unsigned long)pressPipeline.stats().maxLatencyMs);
+  const LatencyHistogram &captureLatency = pressPipeline.captureLatency();
+  if (captureLatency.count() > 0)
+  {
+    Serial.printf("Latency edge to capture: p50 %lu us, p99 %lu us, max %lu us\n",
+                  (unsigned long)captureLatency.percentile(0.5f), (unsigned long)captureLatency.percentile(0.99f),
+                  (unsigned long)captureLatency.max());
+  }
+  // Without --profile this is the simulated time, so passes per second is
+  // how often the device's tasks would wake
+  uint64_t simulatedMicros = micros() - trainStart;
+  Serial.printf("%lu loop passes in %.1f s, %.1f per second\n", passes, simulatedMicros / 1e6,
+                simulatedMicros ? passes * 1e6 / simulatedMicros : 0.0);
+  Serial.printf("Heap high-water %lu bytes above the %lu at start, pipeline %lu bytes for %u channels\n",
+                (unsigned long)(heapHighWater - heapBaseline), (unsigned long)heapBaseline,
+                (unsigned long)sizeof(PressPipeline), (unsigned)PressPipeline::MAX_CHANNELS);
+  Serial.printf("Heap allocations %lu, %.2f per press\n", (unsigned long)allocations, (double)allocations / presses);
+
+  if (options.profile)
+  {
+    uint64_t total = times.capture + times.replay + times.process + times.poll + times.delivery;
+    Serial.printf("%lu loop passes, %.2f us per press: capture %.2f, replay %.2f, "
+                  "process %.2f, poll %.2f, delivery %.2f\n",
+                  passes, (double)total / presses,
+                  (double)times.capture / presses, (double)times.replay / presses,
+                  (double)times.process / presses, (double)times.poll / presses,
+                  (double)times.delivery / presses);
+    // Capture walks every channel's ring on every pass, so this is where
+    // an extra channel shows up
+    Serial.printf("Capture %.1f ns per loop pass for %u channels\n",
+                  (double)times.capture * 1000 / passes, (unsigned)channels);
+    printFrameEncoding(logRecords, pressPipeline.batching().maxSize);
+    const LogWriterStats &writerStats = writer.stats();
+    Serial.printf("Log writer: %lu flushes, %lu bytes, flush avg %lu us\n",
+                  (unsigned long)writerStats.flushes, (unsigned long)writerStats.bytesWritten,
+                  (unsigned long)(writerStats.flushes ? writerStats.totalFlushMicros / writerStats.flushes : 0));
+  }
+
+  writer.close();
+  hal::host::removeDirectory(root);
+  return complete ? 0 : 1;
+}
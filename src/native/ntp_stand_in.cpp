@@ -0,0 +1,42 @@
+#include "ntp_stand_in.h"
+
+NtpStandIn::NtpStandIn(const NtpSettings &settings)
+    : settings(settings)
+{
+}
+
+uint64_t NtpStandIn::nextEventMicros() const
+{
+  return answering ? answerAt : nextRequestAt;
+}
+
+bool NtpStandIn::fire(int64_t &ntpEpochMicros)
+{
+  // The client waits for an answer on the way before it asks again
+  if (answering)
+  {
+    ntpEpochMicros = epochMicrosAt(answerAt);
+    answering = false;
+    answerCount++;
+    nextRequestAt = answerAt + settings.resyncMicros;
+    return true;
+  }
+
+  uint64_t now = nextRequestAt;
+  if (requestCount++ >= settings.drops)
+  {
+    answering = true;
+    answerAt = now + settings.delayMicros;
+  }
+  else
+  {
+    nextRequestAt = now + (answerCount > 0 ? settings.resyncMicros : settings.retryMicros);
+  }
+  return false;
+}
+
+int64_t NtpStandIn::epochMicrosAt(uint64_t monotonicMicros) const
+{
+  return EPOCH_MICROS_AT_BOOT + (int64_t)monotonicMicros +
+         (int64_t)(monotonicMicros * settings.driftPpm / 1000000);
+}
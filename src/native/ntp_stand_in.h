@@ -0,0 +1,48 @@
+#ifndef NTP_STAND_IN_H
+#define NTP_STAND_IN_H
+
+#include <stdint.h>
+
+struct NtpSettings
+{
+  uint64_t delayMicros;   // From a request to its answer
+  unsigned long drops;    // Requests at the start that get no answer
+  uint64_t retryMicros;   // Until the first answer
+  uint64_t resyncMicros;  // After it
+  unsigned long driftPpm; // How much faster the server's clock runs
+};
+
+// An NTP server and the device's SNTP client on the virtual clock. The
+// client asks at boot, again every retryMicros until it gets an answer and
+// every resyncMicros after that. The server drops the first `drops`
+// requests and answers the rest after delayMicros, with its time as of the
+// moment the answer arrives, as SNTP works it out from the round trip.
+// Its clock runs driftPpm faster than micros(), like a board whose crystal
+// is slow.
+class NtpStandIn
+{
+public:
+  static const int64_t EPOCH_MICROS_AT_BOOT = 1700000000LL * 1000000;
+
+  explicit NtpStandIn(const NtpSettings &settings);
+
+  // micros() of the next request or answer
+  uint64_t nextEventMicros() const;
+  // Handles that event; true for an answer, which carries ntpEpochMicros
+  bool fire(int64_t &ntpEpochMicros);
+  // The server's time at a micros() reading
+  int64_t epochMicrosAt(uint64_t monotonicMicros) const;
+
+  unsigned long requests() const { return requestCount; }
+  unsigned long answers() const { return answerCount; }
+
+private:
+  NtpSettings settings;
+  uint64_t nextRequestAt = 0;
+  bool answering = false;
+  uint64_t answerAt = 0;
+  unsigned long requestCount = 0;
+  unsigned long answerCount = 0;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "pulse_train.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// xorshift32, so a seed gives the same train with any standard library
+static uint32_t nextRandom(uint32_t &state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Uniform in (0, 1)
+static double nextUniform(uint32_t &state)
+{
+  return (nextRandom(state) + 0.5) / 4294967296.0;
+}
+
+// Turns press start times into edges. A press is released after
+// PRESS_WIDTH_MICROS, or halfway to the next press when that comes sooner.
+static PulseTrain buildTrain(const std::vector<uint64_t> &starts)
+{
+  PulseTrain train;
+  train.presses = starts.size();
+  for (size_t i = 0; i < starts.size(); i++)
+  {
+    uint64_t width = PRESS_WIDTH_MICROS;
+    if (i + 1 < starts.size() && (starts[i + 1] - starts[i]) / 2 < width)
+    {
+      width = (starts[i + 1] - starts[i]) / 2;
+    }
+    width = width < 1 ? 1 : width;
+    train.edges.push_back({starts[i], 0});
+    train.edges.push_back({starts[i] + width, 1});
+  }
+  return train;
+}
+
+PulseTrain constantTrain(unsigned long presses, uint64_t periodMicros)
+{
+  std::vector<uint64_t> starts;
+  for (unsigned long i = 0; i < presses; i++)
+  {
+    starts.push_back(i * periodMicros);
+  }
+  return buildTrain(starts);
+}
+
+PulseTrain poissonTrain(unsigned long presses, uint64_t meanPeriodMicros, uint32_t seed)
+{
+  uint32_t state = seed ? seed : 1;
+  std::vector<uint64_t> starts;
+  uint64_t at = 0;
+  for (unsigned long i = 0; i < presses; i++)
+  {
+    starts.push_back(at);
+    // Two edges need at least two distinct microseconds
+    at += 2 + (uint64_t)(-log(nextUniform(state)) * meanPeriodMicros);
+  }
+  return buildTrain(starts);
+}
+
+PulseTrain burstyTrain(unsigned long presses, unsigned long burstSize,
+                       uint64_t periodMicros, uint64_t gapMicros)
+{
+  std::vector<uint64_t> starts;
+  uint64_t at = 0;
+  for (unsigned long i = 0; i < presses; i++)
+  {
+    starts.push_back(at);
+    at += (i + 1) % burstSize == 0 ? gapMicros : periodMicros;
+  }
+  return buildTrain(starts);
+}
+
+PulseTrain chatterTrain(unsigned long presses, uint64_t periodMicros,
+                        unsigned long bounces, uint64_t bounceMicros, uint32_t seed)
+{
+  uint32_t state = seed ? seed : 1;
+  PulseTrain train = constantTrain(presses, periodMicros);
+  std::vector<PulseEdge> edges;
+  for (size_t i = 0; i < train.edges.size(); i += 2)
+  {
+    const PulseEdge &press = train.edges[i];
+    const PulseEdge &release = train.edges[i + 1];
+    edges.push_back(press);
+
+    // Each bounce opens and closes the contact once, inside its own slot of
+    // the bounce window so the edges stay ordered
+    uint64_t window = bounceMicros < release.atMicros - press.atMicros ? bounceMicros : release.atMicros - press.atMicros - 1;
+    unsigned long count = bounces ? 1 + nextRandom(state) % bounces : 0;
+    uint64_t slot = count ? window / count : 0;
+    for (unsigned long bounce = 0; bounce < count && slot >= 3; bounce++)
+    {
+      uint64_t slotStart = press.atMicros + 1 + bounce * slot;
+      uint64_t open = slotStart + nextRandom(state) % (slot / 2);
+      uint64_t close = open + 1 + nextRandom(state) % (slot / 2);
+      edges.push_back({open, 1});
+      edges.push_back({close, 0});
+    }
+    edges.push_back(release);
+  }
+  train.edges = edges;
+  return train;
+}
+
+bool loadPulseTrain(const char *path, PulseTrain &train)
+{
+  FILE *in = fopen(path, "r");
+  if (!in)
+  {
+    return false;
+  }
+
+  std::vector<uint64_t> starts;
+  char line[128];
+  while (fgets(line, sizeof(line), in))
+  {
+    char *end;
+    double atMs = strtod(line, &end);
+    if (end == line || line[0] == '#')
+    {
+      continue;
+    }
+    uint64_t at = (uint64_t)(atMs * 1000);
+    if (!starts.empty() && at <= starts.back())
+    {
+      fprintf(stderr, "%s: press times must increase\n", path);
+      fclose(in);
+      return false;
+    }
+    starts.push_back(at);
+  }
+  fclose(in);
+
+  train = buildTrain(starts);
+  return true;
+}
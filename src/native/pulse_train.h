@@ -0,0 +1,42 @@
+#ifndef PULSE_TRAIN_H
+#define PULSE_TRAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Pin edges to feed through the simulated button pin, in time order. The
+// pin idles HIGH (pull-up) and a press pulls it LOW.
+struct PulseEdge
+{
+  uint64_t atMicros;
+  uint8_t level;
+};
+
+struct PulseTrain
+{
+  std::vector<PulseEdge> edges;
+  // Presses the train stands for; contact bounce adds edges, not presses
+  unsigned long presses = 0;
+};
+
+// How long a generated press holds the pin LOW
+const uint64_t PRESS_WIDTH_MICROS = 50000;
+
+// Generators take the number of presses and return the same train for the
+// same arguments, on every host.
+PulseTrain constantTrain(unsigned long presses, uint64_t periodMicros);
+// Exponentially distributed gaps with the given mean
+PulseTrain poissonTrain(unsigned long presses, uint64_t meanPeriodMicros, uint32_t seed);
+// Bursts of burstSize presses periodMicros apart, separated by gapMicros
+PulseTrain burstyTrain(unsigned long presses, unsigned long burstSize,
+                       uint64_t periodMicros, uint64_t gapMicros);
+// Constant rate, but every press bounces up to `bounces` times within
+// bounceMicros of the first edge
+PulseTrain chatterTrain(unsigned long presses, uint64_t periodMicros,
+                        unsigned long bounces, uint64_t bounceMicros, uint32_t seed);
+// Recorded presses: one press time in milliseconds per line, '#' starts
+// a comment
+bool loadPulseTrain(const char *path, PulseTrain &train);
+
+#endif
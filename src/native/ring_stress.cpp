@@ -0,0 +1,153 @@
+#include "ring_stress.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "hal/hal.h"
+#include "event_ring.h"
+#include "event_record.h"
+#include "press_pipeline.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef EventRing<EventRecord, PressPipeline::PULSE_RING_CAPACITY> StressRing;
+
+namespace
+{
+  struct RunResult
+  {
+    unsigned long pushed;
+    unsigned long popped;
+    unsigned long overflows;
+    unsigned long outOfOrder; // Sequence not above the previous one
+    unsigned long torn;       // Fields that don't match the sequence
+  };
+
+  EventRecord makeItem(uint32_t sequence)
+  {
+    return {(int64_t)sequence * 3 + 1700000000000LL, sequence, ~sequence, (uint8_t)sequence, (uint8_t)(sequence >> 8)};
+  }
+
+  bool intact(const EventRecord &item)
+  {
+    EventRecord expected = makeItem(item.sequence);
+    return item.epochMillis == expected.epochMillis && item.count == expected.count &&
+           item.channel == expected.channel && item.reserved == expected.reserved;
+  }
+
+  // Pops until the producer is done and the ring is empty
+  void consume(StressRing &ring, const std::atomic<bool> &producing, unsigned long drainMicros, RunResult &result)
+  {
+    int64_t last = -1;
+    while (true)
+    {
+      bool done = !producing.load(std::memory_order_acquire);
+      EventRecord item;
+      while (ring.pop(item))
+      {
+        result.popped++;
+        result.outOfOrder += (int64_t)item.sequence > last ? 0 : 1;
+        result.torn += intact(item) ? 0 : 1;
+        last = item.sequence;
+      }
+      if (done)
+      {
+        return;
+      }
+      if (drainMicros > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(drainMicros));
+      }
+      else if (ring.empty())
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+      }
+    }
+  }
+
+  // Pushes at rate items/s. Items whose time passed while the thread
+  // slept go in back to back, as edges queued behind a busy core would.
+  RunResult pacedRun(unsigned long rate, unsigned long stepMs, unsigned long drainMicros)
+  {
+    StressRing ring;
+    std::atomic<bool> producing{true};
+    RunResult result = {};
+    std::thread consumer(consume, std::ref(ring), std::cref(producing), drainMicros, std::ref(result));
+
+    unsigned long items = (unsigned long)((uint64_t)rate * stepMs / 1000);
+    Clock::time_point start = Clock::now();
+    unsigned long overflowsBefore = ring.overflowCount();
+    for (unsigned long i = 0; i < items; i++)
+    {
+      Clock::time_point due = start + std::chrono::nanoseconds((uint64_t)i * 1000000000ULL / rate);
+      std::this_thread::sleep_until(due);
+      ring.push(makeItem(i));
+    }
+    producing.store(false, std::memory_order_release);
+    consumer.join();
+
+    result.pushed = items;
+    result.overflows = ring.overflowCount() - overflowsBefore;
+    return result;
+  }
+
+  RunResult burstRun(unsigned long items)
+  {
+    StressRing ring;
+    std::atomic<bool> producing{true};
+    RunResult result = {};
+    std::thread consumer(consume, std::ref(ring), std::cref(producing), 0, std::ref(result));
+
+    unsigned long retries = 0;
+    for (unsigned long i = 0; i < items; i++)
+    {
+      // Sleep rather than spin, so a single-core host runs the consumer
+      while (!ring.push(makeItem(i)))
+      {
+        retries++;
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+      }
+    }
+    producing.store(false, std::memory_order_release);
+    consumer.join();
+
+    // Retried pushes count as overflows in the ring but lose nothing
+    result.pushed = items;
+    result.overflows = ring.overflowCount() - (uint32_t)retries;
+    return result;
+  }
+
+  bool sound(const RunResult &result)
+  {
+    return result.popped + result.overflows == result.pushed && result.outOfOrder == 0 && result.torn == 0;
+  }
+}
+
+bool runRingStress(const RingStressSettings &settings)
+{
+  const unsigned long RATES[] = {1000, 4000, 16000, 64000, 256000, 1024000};
+  bool passed = true;
+  bool losslessSoFar = true;
+  unsigned long lossless = 0;
+  for (unsigned long rate : RATES)
+  {
+    RunResult result = pacedRun(rate, settings.stepMs, settings.drainMicros);
+    Serial.printf("RING {\"rate\":%lu,\"drainUs\":%lu,\"pushed\":%lu,\"popped\":%lu,\"overflows\":%lu,"
+           "\"outOfOrder\":%lu,\"torn\":%lu}\n",
+           rate, settings.drainMicros, result.pushed, result.popped, result.overflows,
+           result.outOfOrder, result.torn);
+    passed = passed && sound(result) && (rate > settings.requiredRate || result.overflows == 0);
+    losslessSoFar = losslessSoFar && result.overflows == 0;
+    lossless = losslessSoFar ? rate : lossless;
+  }
+
+  Clock::time_point start = Clock::now();
+  RunResult burst = burstRun(settings.burstItems);
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  bool burstSound = sound(burst) && burst.popped == burst.pushed;
+  Serial.printf("RING {\"burst\":true,\"pushed\":%lu,\"popped\":%lu,\"outOfOrder\":%lu,\"torn\":%lu,\"itemsPerSecond\":%.0f}\n",
+         burst.pushed, burst.popped, burst.outOfOrder, burst.torn, seconds > 0 ? burst.pushed / seconds : 0.0);
+  passed = passed && burstSound;
+
+  Serial.printf("RING {\"summary\":true,\"losslessRate\":%lu,\"requiredRate\":%lu,\"capacity\":%u,\"passed\":%s}\n",
+         lossless, settings.requiredRate, (unsigned)StressRing::capacity(), passed ? "true" : "false");
+  return passed;
+}
@@ -0,0 +1,26 @@
+#ifndef RING_STRESS_H
+#define RING_STRESS_H
+
+#include <stdint.h>
+
+struct RingStressSettings
+{
+  unsigned long stepMs;       // How long each paced rate runs
+  unsigned long drainMicros;  // Consumer pause between drains
+  unsigned long requiredRate; // Pulses/s that have to get through without loss
+  unsigned long burstItems;   // Items in the back-to-back run
+};
+
+// EventRing with a real producer thread and consumer thread, at the
+// capacity of the pulse rings. Paced runs push at rising rates while the
+// consumer drains every drainMicros, as the capture task would, and find
+// the highest rate without loss. A back-to-back run then pushes as fast as
+// the ring takes items, retrying when full, with the consumer spinning.
+//
+// Every item carries its sequence and fields derived from it, so the
+// consumer sees a lost, repeated, reordered or torn item. Prints a line
+// per run and returns false on any of those, or when a rate up to
+// requiredRate lost an item.
+bool runRingStress(const RingStressSettings &settings);
+
+#endif
@@ -0,0 +1,315 @@
+#include "press_pipeline.h"
+#include "event_codec.h"
+
+PressPipeline::PressPipeline(SegmentedLog &log, HistoryReplay &replay, size_t channels)
+    : log(log), replay(replay), channels(channels < MAX_CHANNELS ? channels : MAX_CHANNELS)
+{
+  for (ChannelState &channel : state)
+  {
+    channel.previousPulseMicros = 0;
+    channel.debounceMs = DEBOUNCE_DELAY;
+    channel.reportedOverflows = 0;
+    channel.count = 0;
+    channel.loggedCount = 0;
+  }
+}
+
+bool IRAM_ATTR PressPipeline::onPulse(uint8_t channel)
+{
+  ChannelState &input = state[channel];
+  int64_t now = hal::monotonicMicros();
+  if (now - input.previousPulseMicros <= (int64_t)input.debounceMs * 1000)
+  {
+    return false;
+  }
+  input.pulseRing.push(now);
+  input.previousPulseMicros = now;
+  return true;
+}
+
+void PressPipeline::capture()
+{
+  int64_t captureMicros = hal::monotonicMicros();
+  int64_t captureEpochMicros = hal::epochMicros();
+  clockOffsetMicros = captureEpochMicros - captureMicros;
+  clockSet = wallClockSet(captureEpochMicros);
+
+  for (uint8_t channel = 0; channel < channels; channel++)
+  {
+    // Drain every press queued by the ISR since the last pass
+    ChannelState &input = state[channel];
+    int64_t pressMicros;
+    while (input.pulseRing.pop(pressMicros))
+    {
+      input.count++;
+      captureLatencyHistogram.add(captureMicros > pressMicros ? (uint32_t)(captureMicros - pressMicros) : 0);
+      queueRecord(channel, pressMicros);
+      if (rates)
+      {
+        rates->addPulses(channel, 1, pressMicros, clockSet ? (uint32_t)(toEpochMicros(pressMicros) / 1000000) : 0);
+      }
+      if (verbose)
+      {
+        Serial.printf("Channel %u pressed\n", (unsigned)channel);
+      }
+    }
+
+    uint32_t overflows = input.pulseRing.overflowCount();
+    if (overflows != input.reportedOverflows)
+    {
+      Serial.printf("Pulse ring overflow on channel %u, %u presses dropped\n",
+                    (unsigned)channel, overflows - input.reportedOverflows);
+      input.reportedOverflows = overflows;
+    }
+  }
+
+  uint32_t unheld = held.overflowCount();
+  if (unheld != reportedUnheld)
+  {
+    Serial.printf("Clock not set and no room to hold the record, %u presses counted without one\n",
+                  unheld - reportedUnheld);
+    reportedUnheld = unheld;
+  }
+}
+
+void PressPipeline::captureCount(uint8_t channel, uint32_t pulses)
+{
+  if (pulses == 0)
+  {
+    return;
+  }
+  state[channel].count += pulses;
+  int64_t nowMicros = hal::monotonicMicros();
+  queueRecord(channel, nowMicros);
+  if (rates)
+  {
+    rates->addPulses(channel, pulses, nowMicros, clockSet ? (uint32_t)(toEpochMicros(nowMicros) / 1000000) : 0);
+  }
+  if (verbose)
+  {
+    Serial.printf("Pulse counter on channel %u: %lu pulses\n", (unsigned)channel, (unsigned long)pulses);
+  }
+}
+
+void PressPipeline::queueRecord(uint8_t channel, int64_t pressMicros)
+{
+  EventRecord record = {};
+  record.sequence = nextEventSequence++;
+  record.channel = channel;
+  record.count = state[channel].count;
+
+  // Once the clock is set, records still go through held until process()
+  // has emitted the last one put there, so pending never overtakes it.
+  // held.empty() is no test for that: process() may have popped the last
+  // held record and not yet emitted it.
+  if (holding && heldEmitted.load(std::memory_order_acquire) == lastHeldSequence)
+  {
+    holding = false;
+  }
+  if (!clockSet || holding)
+  {
+    stamp(record, pressMicros);
+    if (held.push(record))
+    {
+      holding = true;
+      lastHeldSequence = record.sequence;
+    }
+    return;
+  }
+
+  stamp(record, toEpochMicros(pressMicros));
+  if (!pending.push(record))
+  {
+    Serial.println("Event pool full, press not logged");
+  }
+}
+
+void PressPipeline::stamp(EventRecord &record, int64_t micros)
+{
+  record.epochMillis = micros / 1000;
+}
+
+size_t PressPipeline::pulseBacklog() const
+{
+  size_t backlog = 0;
+  for (size_t channel = 0; channel < channels; channel++)
+  {
+    backlog += state[channel].pulseRing.size();
+  }
+  return backlog;
+}
+
+uint32_t PressPipeline::droppedPulses() const
+{
+  uint32_t dropped = pending.overflowCount();
+  for (size_t channel = 0; channel < channels; channel++)
+  {
+    dropped += state[channel].pulseRing.overflowCount();
+  }
+  return dropped;
+}
+
+void PressPipeline::process()
+{
+  if (!held.empty() && wallClockSet(hal::epochMicros()))
+  {
+    emitHeld();
+  }
+
+  if (pending.empty())
+  {
+    batchOpen = false;
+    pendingSeen = 0;
+    return;
+  }
+
+  unsigned long now = millis();
+  if (!batchOpen)
+  {
+    batchOpen = true;
+    batchOpenedAt = now;
+  }
+  // Only capture adds to pending, so a larger size means a record joined
+  if (pending.size() != pendingSeen)
+  {
+    pendingSeen = pending.size();
+    lastJoinedAt = now;
+  }
+
+  size_t maxSize = batchSettings.maxSize;
+  if (pending.size() < maxSize && now - batchOpenedAt < batchSettings.windowMs &&
+      now - lastJoinedAt < BATCH_QUIET_MS)
+  {
+    return;
+  }
+
+  size_t count = 0;
+  while (count < maxSize && pending.pop(batch[count]))
+  {
+    count++;
+  }
+
+  emitBatch(batch, count);
+
+  // Whatever is left over starts the next window
+  batchOpen = !pending.empty();
+  batchOpenedAt = millis();
+  pendingSeen = pending.size();
+}
+
+// Restamps the records held while the clock was not set, oldest first, and
+// emits them in full batches; they are late already, so no window applies
+// and they stay out of the latency figures
+void PressPipeline::emitHeld()
+{
+  int64_t offsetMicros = hal::epochMicros() - hal::monotonicMicros();
+  size_t maxSize = batchSettings.maxSize;
+  size_t count = 0;
+  EventRecord record;
+  while (held.pop(record))
+  {
+    stamp(record, record.epochMillis * 1000 + offsetMicros);
+    batch[count++] = record;
+    if (count == maxSize || held.empty())
+    {
+      emitBatch(batch, count, false);
+      backfilled += count;
+      heldEmitted.store(batch[count - 1].sequence, std::memory_order_release);
+      count = 0;
+    }
+  }
+}
+
+unsigned long PressPipeline::msUntilBatch() const
+{
+  if (!held.empty() && wallClockSet(hal::epochMicros()))
+  {
+    return 0;
+  }
+  if (pending.empty())
+  {
+    return ULONG_MAX;
+  }
+  if (!batchOpen || pending.size() >= batchSettings.maxSize || pending.size() != pendingSeen)
+  {
+    return 0;
+  }
+  unsigned long waited = millis() - batchOpenedAt;
+  unsigned long quiet = millis() - lastJoinedAt;
+  unsigned long untilWindow = waited < batchSettings.windowMs ? batchSettings.windowMs - waited : 0;
+  unsigned long untilQuiet = quiet < BATCH_QUIET_MS ? BATCH_QUIET_MS - quiet : 0;
+  return untilWindow < untilQuiet ? untilWindow : untilQuiet;
+}
+
+void PressPipeline::restore(uint8_t channel, ulong count)
+{
+  state[channel].count = state[channel].loggedCount = count;
+}
+
+void PressPipeline::resetCount()
+{
+  for (ChannelState &channel : state)
+  {
+    channel.count = channel.loggedCount = 0;
+  }
+}
+
+void PressPipeline::setBatching(size_t maxSize, unsigned long windowMs)
+{
+  batchSettings.maxSize = maxSize;
+  batchSettings.windowMs = windowMs;
+}
+
+void PressPipeline::emitBatch(const EventRecord *records, size_t count, bool measureLatency)
+{
+  // One log record per press, then a frame per format some client wants,
+  // serialized straight into the buffer the client queues share
+  unsigned long startMicros = micros();
+
+  for (size_t i = 0; i < count; i++)
+  {
+    log.append(records[i]);
+    state[records[i].channel].loggedCount = records[i].count;
+    if (rollups)
+    {
+      rollups->add(records[i]);
+    }
+  }
+
+  AsyncWebSocketSharedBuffer json;
+  AsyncWebSocketSharedBuffer binary;
+  if (replay.textClients() > 0)
+  {
+    json = std::make_shared<std::vector<uint8_t>>(count * (EVENT_JSON_MAX_LENGTH + 1) + 2);
+    json->resize(encodeEventJsonArray(records, count, (char *)json->data()));
+  }
+  if (replay.binaryClients() > 0)
+  {
+    binary = std::make_shared<std::vector<uint8_t>>(EVENT_FRAME_HEADER_SIZE + count * EVENT_FRAME_RECORD_MAX_SIZE);
+    binary->resize(encodeEventFrame(records, count, binary->data()));
+  }
+  replay.broadcastEvents(json, binary);
+
+  // Latency is measured from the press to the moment the batch went out
+  int64_t nowMs = hal::epochMillis();
+  for (size_t i = 0; measureLatency && i < count; i++)
+  {
+    int64_t pressMs = records[i].epochMillis;
+    uint32_t latencyMs = nowMs > pressMs ? (uint32_t)(nowMs - pressMs) : 0;
+    batchStats.totalLatencyMs += latencyMs;
+    latencyHistogram.add(latencyMs);
+    if (latencyMs > batchStats.maxLatencyMs)
+    {
+      batchStats.maxLatencyMs = latencyMs;
+    }
+  }
+  batchStats.batches++;
+  batchStats.events += count;
+  batchStats.totalEmitMicros += micros() - startMicros;
+
+  if (verbose)
+  {
+    Serial.printf("Batch of %u presses emitted, last count %lu\n",
+                  (unsigned)count, (unsigned long)records[count - 1].count);
+  }
+}
@@ -0,0 +1,197 @@
+#ifndef PRESS_PIPELINE_H
+#define PRESS_PIPELINE_H
+
+#include "hal/hal.h"
+#include <atomic>
+#include "clock_sync.h"
+#include "event_record.h"
+#include "event_ring.h"
+#include "history_replay.h"
+#include "latency_histogram.h"
+#include "rate_engine.h"
+#include "rollup_store.h"
+#include "segmented_log.h"
+
+// A batch is emitted once it holds maxSize records, its first record has
+// waited windowMs, or no record joined it for PressPipeline::BATCH_QUIET_MS,
+// whichever comes first. maxSize and windowMs are changed at runtime
+// through /settings.
+struct BatchSettings
+{
+  volatile size_t maxSize;
+  volatile unsigned long windowMs;
+};
+
+struct BatchStats
+{
+  uint32_t batches;
+  uint32_t events;
+  uint32_t totalLatencyMs;
+  uint32_t maxLatencyMs;
+  uint32_t totalEmitMicros;
+};
+
+// The path of a press from the pin interrupt to flash and the WebSocket
+// clients: onPulse() queues the monotonic time of the edge in
+// microseconds, capture() turns it into an EventRecord stamped with the
+// wall-clock time of the edge and process() batches records, appends them to the log and
+// broadcasts them. capture() and process() may run in different tasks, the
+// rings between the stages need no lock; everything else stays on the
+// task that calls process(). A channel on the pulse counter skips the ISR
+// and hands whole counts to captureCount() on the capture side.
+//
+// Every channel has its own pulse ring, debounce and count; records of all
+// channels share the sequence, the batches and the log, tagged with their
+// channel.
+//
+// Until the wall clock has been set, capture() stamps records with the
+// time since boot and holds them back. Once it is set, process() restamps
+// them through the offset between the clocks and emits them ahead of
+// anything newer, so counting starts at boot without a 1970 record ever
+// reaching the log or the clients.
+class PressPipeline
+{
+public:
+  static const size_t MAX_CHANNELS = 4;
+  // Records waiting for process(), preallocated so capture never touches
+  // the heap
+  static const size_t EVENT_POOL_CAPACITY = 32;
+  static const size_t MAX_BATCH_SIZE = EVENT_POOL_CAPACITY;
+  // With DEBOUNCE_DELAY the ISR accepts at most 4 presses/s, so 64 slots
+  // cover a capture stall of 16 s before anything is dropped.
+  static const size_t PULSE_RING_CAPACITY = 64;
+  // Records captured before the clock was set: 6 KB, 64 s of presses at
+  // the debounce limit on one channel. Presses past that are still
+  // counted, the next record that fits carries their count.
+  static const size_t HELD_CAPACITY = 256;
+  static const unsigned long DEBOUNCE_DELAY = 250;
+  // A batch nothing joined for this long goes out before its window ends,
+  // so an isolated press is not held back; records arriving closer
+  // together than this still share a frame
+  static const unsigned long BATCH_QUIET_MS = 5;
+
+  PressPipeline(SegmentedLog &log, HistoryReplay &replay, size_t channels = 1);
+
+  size_t channelCount() const { return channels; }
+  void setDebounce(uint8_t channel, unsigned long debounceMs) { state[channel].debounceMs = debounceMs; }
+
+  // Called from the channel's pin interrupt. False for an edge inside the
+  // debounce delay, which needs no capture.
+  bool onPulse(uint8_t channel);
+  // Queues a pulse past the debounce, for load tests
+  void injectPulse(int64_t pressMicros, uint8_t channel = 0) { state[channel].pulseRing.push(pressMicros); }
+
+  // Called from the capture and persistence tasks, or loop() on the host
+  void capture();
+  void process();
+  // Pulses a hardware counter saw since the last call, as one record
+  void captureCount(uint8_t channel, uint32_t pulses);
+  // How long process() can sleep before a batch is due, ULONG_MAX with
+  // nothing pending
+  unsigned long msUntilBatch() const;
+
+  // Counts and sequence restored at boot. A reset clears the counts but the
+  // sequence keeps running, so clients can resume by it.
+  void restore(uint8_t channel, ulong count);
+  void restoreSequence(uint32_t nextSequence) { nextEventSequence = nextSequence; }
+  void resetCount();
+  ulong count(uint8_t channel = 0) const { return state[channel].count; }
+  // Count of the channel's last record handed to the log
+  ulong loggedCount(uint8_t channel = 0) const { return state[channel].loggedCount; }
+  uint32_t nextSequence() const { return nextEventSequence; }
+
+  // Gets every pulse as it is captured, with its monotonic time
+  void setRateEngine(RateEngine *rates) { this->rates = rates; }
+  // Gets every record as it is handed to the log
+  void setRollupStore(RollupStore *rollups) { this->rollups = rollups; }
+
+  // Per-press and per-batch lines on Serial
+  void setVerbose(bool verbose) { this->verbose = verbose; }
+
+  // Wall-clock time of a monotonicMicros() reading, through the offset
+  // between the two clocks as of the last capture()
+  int64_t toEpochMicros(int64_t monotonic) const { return monotonic + clockOffsetMicros; }
+
+  // Queue depths, and presses lost to a full pulse ring or event pool
+  size_t pulseBacklog() const;
+  size_t pendingRecords() const { return pending.size(); }
+  uint32_t droppedPulses() const;
+  // Records waiting for the clock, and how many were restamped or had no room
+  size_t heldRecords() const { return held.size(); }
+  uint32_t backfilledRecords() const { return backfilled; }
+  uint32_t unheldRecords() const { return held.overflowCount(); }
+
+  void setBatching(size_t maxSize, unsigned long windowMs);
+  const BatchSettings &batching() const { return batchSettings; }
+  const BatchStats &stats() const { return batchStats; }
+  // Press to broadcast, per press
+  const LatencyHistogram &latency() const { return latencyHistogram; }
+  // Edge to capture() in microseconds, per interrupt pulse: how long
+  // pulses wait in the ring for the capture task
+  const LatencyHistogram &captureLatency() const { return captureLatencyHistogram; }
+  void resetCaptureLatency() { captureLatencyHistogram.clear(); }
+  void resetStats()
+  {
+    batchStats = {};
+    latencyHistogram.clear();
+    captureLatencyHistogram.clear();
+  }
+
+private:
+  struct ChannelState
+  {
+    // Edge times (hal::monotonicMicros) handed from the ISR to capture()
+    EventRing<int64_t, PULSE_RING_CAPACITY> pulseRing;
+    volatile int64_t previousPulseMicros;
+    unsigned long debounceMs;
+    uint32_t reportedOverflows;
+    ulong count;
+    ulong loggedCount;
+  };
+
+  // pressMicros is hal::monotonicMicros()
+  void queueRecord(uint8_t channel, int64_t pressMicros);
+  static void stamp(EventRecord &record, int64_t micros);
+  void emitBatch(const EventRecord *records, size_t count, bool measureLatency = true);
+  void emitHeld();
+
+  SegmentedLog &log;
+  HistoryReplay &replay;
+  RateEngine *rates = nullptr;
+  RollupStore *rollups = nullptr;
+
+  size_t channels;
+  ChannelState state[MAX_CHANNELS];
+
+  EventRing<EventRecord, EVENT_POOL_CAPACITY> pending;
+  // Stamped with hal::monotonicMicros() instead of the wall clock
+  EventRing<EventRecord, HELD_CAPACITY> held;
+  // Handoff from held back to pending. Capture keeps holding, and the
+  // sequence of the last record it held; emitHeld() publishes the
+  // sequence of the last record it emitted.
+  bool holding = false;
+  uint32_t lastHeldSequence = 0;
+  std::atomic<uint32_t> heldEmitted{0};
+  uint32_t backfilled = 0;
+  uint32_t reportedUnheld = 0;
+  EventRecord batch[MAX_BATCH_SIZE];
+  bool batchOpen = false;
+  unsigned long batchOpenedAt = 0;
+  // pending.size() as process() last saw it, and when it last grew
+  size_t pendingSeen = 0;
+  unsigned long lastJoinedAt = 0;
+
+  uint32_t nextEventSequence = 0;
+  bool verbose = true;
+  // Wall clock minus monotonic clock. Re-read every capture() pass, so NTP
+  // setting or slewing the clock applies to presses captured after it.
+  int64_t clockOffsetMicros = 0;
+  bool clockSet = false;
+
+  BatchSettings batchSettings = {16, 250};
+  BatchStats batchStats = {};
+  LatencyHistogram latencyHistogram;
+  LatencyHistogram captureLatencyHistogram;
+};
+
+#endif
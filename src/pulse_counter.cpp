@@ -0,0 +1,46 @@
+#include "pulse_counter.h"
+
+PulseCounter::PulseCounter(PressPipeline &pipeline, uint8_t channel, uint8_t unit, uint8_t pin,
+                           uint32_t filterNanos, unsigned long harvestIntervalMs)
+    : pipeline(pipeline), channel(channel), unit(unit), pin(pin), filterNanos(filterNanos),
+      harvestIntervalMs(harvestIntervalMs)
+{
+}
+
+bool PulseCounter::begin()
+{
+  if (!hal::pulseCounterBegin(unit, pin, filterNanos))
+  {
+    Serial.printf("Pulse counter unit %u on pin %u failed to start\n", (unsigned)unit, (unsigned)pin);
+    return false;
+  }
+  lastTotal = hal::pulseCounterRead(unit);
+  lastHarvestAt = millis();
+  return true;
+}
+
+void PulseCounter::poll()
+{
+  if (millis() - lastHarvestAt >= harvestIntervalMs)
+  {
+    harvest();
+  }
+}
+
+unsigned long PulseCounter::msUntilHarvest() const
+{
+  unsigned long elapsed = millis() - lastHarvestAt;
+  return elapsed < harvestIntervalMs ? harvestIntervalMs - elapsed : 0;
+}
+
+void PulseCounter::harvest()
+{
+  // The total is never cleared, so nothing counted between read and
+  // handover is lost, and wrapping cancels out in the difference
+  uint32_t total = hal::pulseCounterRead(unit);
+  uint32_t pulses = total - lastTotal;
+  lastTotal = total;
+  lastHarvestAt = millis();
+  harvestCount++;
+  pipeline.captureCount(channel, pulses);
+}
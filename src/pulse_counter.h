@@ -0,0 +1,48 @@
+#ifndef PULSE_COUNTER_H
+#define PULSE_COUNTER_H
+
+#include "hal/hal.h"
+#include "channel_config.h"
+#include "press_pipeline.h"
+
+// Capture backend for meters too fast for the debounced interrupt, such as
+// S0 outputs on electricity meters. The PCNT unit counts edges in hardware
+// and poll() hands whatever accumulated since the last harvest to the
+// pipeline as a single record, so the CPU cost follows the harvest
+// interval rather than the pulse rate.
+class PulseCounter
+{
+public:
+  // S0 outputs are transistor switched and don't bounce; the default
+  // filter only rejects noise shorter than ~10 us
+  static const uint32_t DEFAULT_FILTER_NANOS = 10000;
+  static const unsigned long DEFAULT_HARVEST_INTERVAL = 1000;
+
+  PulseCounter(PressPipeline &pipeline, uint8_t channel, uint8_t unit, uint8_t pin,
+               uint32_t filterNanos = DEFAULT_FILTER_NANOS,
+               unsigned long harvestIntervalMs = DEFAULT_HARVEST_INTERVAL);
+
+  bool begin();
+  // Called from the capture task
+  void poll();
+  // How long poll() has nothing to do
+  unsigned long msUntilHarvest() const;
+  // Hands over anything counted right away, e.g. before a checkpoint
+  void harvest();
+
+  uint32_t harvests() const { return harvestCount; }
+
+private:
+  PressPipeline &pipeline;
+  uint8_t channel;
+  uint8_t unit;
+  uint8_t pin;
+  uint32_t filterNanos;
+  unsigned long harvestIntervalMs;
+
+  uint32_t lastTotal = 0;
+  unsigned long lastHarvestAt = 0;
+  uint32_t harvestCount = 0;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "rate_engine.h"
+#include "clock_sync.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+const uint32_t RateEngine::WINDOW_SECONDS[WINDOWS] = {60, 300, 900};
+
+RateEngine::RateEngine(size_t channels)
+    : channels(channels < MAX_CHANNELS ? channels : MAX_CHANNELS)
+{
+  for (ChannelState &channel : state)
+  {
+    channel.unitsPerPulse = 1.0f;
+  }
+  reset();
+}
+
+void RateEngine::setUnitsPerPulse(uint8_t channel, float unitsPerPulse)
+{
+  state[channel].unitsPerPulse = unitsPerPulse;
+}
+
+void RateEngine::reset()
+{
+  for (ChannelState &channel : state)
+  {
+    float unitsPerPulse = channel.unitsPerPulse;
+    channel = {};
+    channel.unitsPerPulse = unitsPerPulse;
+  }
+}
+
+uint32_t RateEngine::nextMidnight(uint32_t epochSeconds)
+{
+  // mktime normalises the day after and picks the DST offset of that night
+  time_t epoch = epochSeconds;
+  struct tm timeinfo;
+  localtime_r(&epoch, &timeinfo);
+  timeinfo.tm_mday++;
+  timeinfo.tm_hour = 0;
+  timeinfo.tm_min = 0;
+  timeinfo.tm_sec = 0;
+  timeinfo.tm_isdst = -1;
+  return (uint32_t)mktime(&timeinfo);
+}
+
+void RateEngine::rollDay(ChannelState &channel, uint32_t epochSeconds)
+{
+  if (!wallClockSetSeconds(epochSeconds) || epochSeconds < channel.todayEnds)
+  {
+    return;
+  }
+  channel.todayPulses = 0;
+  channel.todayEnds = nextMidnight(epochSeconds);
+}
+
+void RateEngine::addPulses(uint8_t channel, uint32_t pulses, int64_t atMicros, uint32_t epochSeconds)
+{
+  ChannelState &input = state[channel];
+  rollDay(input, epochSeconds);
+  input.todayPulses += pulses;
+
+  if (input.seen)
+  {
+    int64_t elapsed = atMicros - input.lastMicros;
+    input.lastIntervalMicros = elapsed > 0 ? elapsed : 1;
+    float elapsedSeconds = (float)elapsed / 1e6f;
+    for (size_t i = 0; i < WINDOWS; i++)
+    {
+      input.average[i] *= expf(-elapsedSeconds / WINDOW_SECONDS[i]);
+    }
+  }
+  for (size_t i = 0; i < WINDOWS; i++)
+  {
+    input.average[i] += (float)pulses / WINDOW_SECONDS[i];
+  }
+  input.seen = true;
+  input.lastMicros = atMicros;
+  input.lastPulses = pulses;
+}
+
+void RateEngine::restoreToday(uint8_t channel, uint32_t pulses, uint32_t epochSeconds)
+{
+  ChannelState &input = state[channel];
+  rollDay(input, epochSeconds);
+  input.todayPulses = pulses;
+}
+
+ChannelRates RateEngine::rates(uint8_t channel, int64_t nowMicros, uint32_t nowEpoch) const
+{
+  const ChannelState &input = state[channel];
+  ChannelRates rates = {};
+  // Pulses per second to units per hour
+  float unitsPerHourFactor = input.unitsPerPulse * 3600.0f;
+
+  if (input.seen && input.lastIntervalMicros > 0)
+  {
+    // Past the last interval without a pulse the rate can only be lower
+    int64_t sinceLast = nowMicros - input.lastMicros;
+    int64_t interval = sinceLast > input.lastIntervalMicros ? sinceLast : input.lastIntervalMicros;
+    float perSecond = input.lastPulses * 1e6f / (float)interval;
+    rates.pulsesPerMinute = perSecond * 60.0f;
+    rates.unitsPerHour = perSecond * unitsPerHourFactor;
+  }
+
+  float sinceLastSeconds = input.seen ? (float)(nowMicros - input.lastMicros) / 1e6f : 0;
+  for (size_t i = 0; i < WINDOWS; i++)
+  {
+    float perSecond = input.average[i] * expf(-sinceLastSeconds / WINDOW_SECONDS[i]);
+    rates.average[i] = perSecond * unitsPerHourFactor;
+  }
+
+  bool dayOver = wallClockSetSeconds(nowEpoch) && nowEpoch >= input.todayEnds;
+  rates.todayPulses = dayOver ? 0 : input.todayPulses;
+  rates.todayUnits = rates.todayPulses * input.unitsPerPulse;
+  return rates;
+}
+
+size_t RateEngine::encodeJson(char *out, size_t capacity, int64_t nowMicros, uint32_t nowEpoch) const
+{
+  size_t length = snprintf(out, capacity, "{\"rates\":[");
+  for (size_t channel = 0; channel < channels && length < capacity; channel++)
+  {
+    ChannelRates current = rates(channel, nowMicros, nowEpoch);
+    length += snprintf(out + length, capacity - length,
+                       "%s{\"channel\":%u,\"pulsesPerMinute\":%.2f,\"unitsPerHour\":%.3f,"
+                       "\"avg1\":%.3f,\"avg5\":%.3f,\"avg15\":%.3f,\"todayPulses\":%lu,\"today\":%.3f}",
+                       channel > 0 ? "," : "", (unsigned)channel, current.pulsesPerMinute,
+                       current.unitsPerHour, current.average[0], current.average[1], current.average[2],
+                       (unsigned long)current.todayPulses, current.todayUnits);
+  }
+  if (length < capacity)
+  {
+    length += snprintf(out + length, capacity - length, "]}");
+  }
+  return length < capacity ? length : capacity - 1;
+}
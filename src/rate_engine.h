@@ -0,0 +1,73 @@
+#ifndef RATE_ENGINE_H
+#define RATE_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What RateEngine reports for one channel
+struct ChannelRates
+{
+  float pulsesPerMinute; // From the last interval between pulses
+  float unitsPerHour;
+  float average[3];      // Units per hour over 1, 5 and 15 minutes
+  uint32_t todayPulses;  // Since local midnight
+  float todayUnits;
+};
+
+// Streaming rate and consumption per channel, updated in O(1) per pulse
+// so nobody has to rebuild it from the history.
+//
+// The current rate is pulses over the last interval, decaying once the
+// next pulse is later than that interval would predict. The averages are
+// exponentially weighted like the Unix load average, but in continuous
+// time: each pulse decays the sum by exp(-dt / window) and adds 1 / window,
+// so there is no timer and no sample buffer. Intervals come from the
+// monotonic clock; only the day boundary uses the wall clock.
+class RateEngine
+{
+public:
+  static const size_t MAX_CHANNELS = 4;
+  static const size_t WINDOWS = 3;
+  static const uint32_t WINDOW_SECONDS[WINDOWS];
+
+  explicit RateEngine(size_t channels = 1);
+
+  void setUnitsPerPulse(uint8_t channel, float unitsPerPulse);
+
+  // pulses counted at atMicros (hal::monotonicMicros), epochSeconds being
+  // the wall-clock time of the same moment
+  void addPulses(uint8_t channel, uint32_t pulses, int64_t atMicros, uint32_t epochSeconds);
+  // Pulses already counted today, e.g. from the log at boot
+  void restoreToday(uint8_t channel, uint32_t pulses, uint32_t epochSeconds);
+  void reset();
+
+  ChannelRates rates(uint8_t channel, int64_t nowMicros, uint32_t nowEpoch) const;
+  // {"rates":[{"channel":N,"pulsesPerMinute":..,"unitsPerHour":..,
+  // "avg1":..,"avg5":..,"avg15":..,"todayPulses":N,"today":..},...]}
+  size_t encodeJson(char *out, size_t capacity, int64_t nowMicros, uint32_t nowEpoch) const;
+  static const size_t JSON_MAX_LENGTH = 16 + MAX_CHANNELS * 160;
+
+  size_t channelCount() const { return channels; }
+
+private:
+  struct ChannelState
+  {
+    float unitsPerPulse;
+    bool seen;
+    int64_t lastMicros;
+    uint32_t lastPulses;
+    int64_t lastIntervalMicros;
+    // Decayed to lastMicros, in pulses per second
+    float average[WINDOWS];
+    uint32_t todayPulses;
+    uint32_t todayEnds; // Epoch of the next local midnight
+  };
+
+  static uint32_t nextMidnight(uint32_t epochSeconds);
+  void rollDay(ChannelState &channel, uint32_t epochSeconds);
+
+  size_t channels;
+  ChannelState state[MAX_CHANNELS];
+};
+
+#endif
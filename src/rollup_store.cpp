@@ -0,0 +1,496 @@
+#include "rollup_store.h"
+#include "clock_sync.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const uint8_t TIER_MAGIC[4] = {'P', 'R', 'U', 'P'};
+static const uint8_t STATE_MAGIC[4] = {'P', 'R', 'S', 'T'};
+static const uint8_t TIER_VERSION = 1;
+static const size_t TIER_HEADER_SIZE = 16;
+static const char *const TIER_NAMES[RollupStore::RESOLUTIONS] = {"minute", "hour", "day"};
+
+// Days from 1970-01-01 to a civil date (H. Hinnant's days_from_civil)
+static uint32_t daysFromCivil(int year, unsigned month, unsigned day)
+{
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  unsigned yearOfEra = (unsigned)(year - era * 400);
+  unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return (uint32_t)(era * 146097 + (int)dayOfEra - 719468);
+}
+
+// Local midnight days after the day of epoch; mktime picks the DST offset
+static uint32_t localMidnight(uint32_t epoch, int days)
+{
+  time_t time = epoch;
+  struct tm timeinfo;
+  localtime_r(&time, &timeinfo);
+  timeinfo.tm_mday += days;
+  timeinfo.tm_hour = 0;
+  timeinfo.tm_min = 0;
+  timeinfo.tm_sec = 0;
+  timeinfo.tm_isdst = -1;
+  return (uint32_t)mktime(&timeinfo);
+}
+
+RollupStore::RollupStore(fs::FS &fs, const char *directory, size_t channels, RollupRetention retention)
+    : filesystem(fs), directory(directory), channels(channels < MAX_CHANNELS ? channels : MAX_CHANNELS), tiers()
+{
+  tiers[(size_t)RollupResolution::Minute].capacity = retention.minutes;
+  tiers[(size_t)RollupResolution::Hour].capacity = retention.hours;
+  tiers[(size_t)RollupResolution::Day].capacity = retention.days;
+}
+
+uint32_t RollupStore::bucketSeconds(RollupResolution resolution)
+{
+  static const uint32_t SECONDS[RESOLUTIONS] = {60, 3600, 86400};
+  return SECONDS[(size_t)resolution];
+}
+
+const char *RollupStore::resolutionName(RollupResolution resolution)
+{
+  return TIER_NAMES[(size_t)resolution];
+}
+
+bool RollupStore::parseResolution(const char *name, RollupResolution &resolution)
+{
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    if (strcmp(name, TIER_NAMES[i]) == 0)
+    {
+      resolution = (RollupResolution)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t RollupStore::bucketIndex(RollupResolution resolution, uint32_t epoch)
+{
+  if (resolution != RollupResolution::Day)
+  {
+    return epoch / bucketSeconds(resolution);
+  }
+  time_t time = epoch;
+  struct tm timeinfo;
+  localtime_r(&time, &timeinfo);
+  return daysFromCivil(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
+}
+
+uint32_t RollupStore::bucketStart(RollupResolution resolution, uint32_t epoch)
+{
+  if (resolution != RollupResolution::Day)
+  {
+    return epoch - epoch % bucketSeconds(resolution);
+  }
+  return localMidnight(epoch, 0);
+}
+
+uint32_t RollupStore::bucketEnd(RollupResolution resolution, uint32_t epoch)
+{
+  if (resolution != RollupResolution::Day)
+  {
+    return bucketStart(resolution, epoch) + bucketSeconds(resolution);
+  }
+  return localMidnight(epoch, 1);
+}
+
+bool RollupStore::begin(SegmentedLog &log)
+{
+  unsigned long startMicros = micros();
+
+  // A state that does not match the files cannot be trusted to say what
+  // they hold, so everything is rebuilt from the log
+  bool stateValid = loadState();
+  bool ok = true;
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    ok = openTier(i, !stateValid) && ok;
+  }
+  if (!stateValid)
+  {
+    Serial.println("Rollup state missing or stale, rebuilding from the log");
+    nextSequence = 0;
+    memset(lastCount, 0, sizeof(lastCount));
+    // Counts start from 0 in a log that retention has not trimmed yet
+    memset(countKnown, log.segment(0).index == 0, sizeof(countKnown));
+    for (Tier &tier : tiers)
+    {
+      tier.open.start = 0;
+      tier.newestIndex = 0;
+    }
+  }
+
+  uint32_t foldedFrom = nextSequence;
+  catchUp(log);
+  saveState();
+
+  Serial.printf("Rollups ready in %lu us, folded sequences %lu-%lu from the log\n",
+                micros() - startMicros, (unsigned long)foldedFrom, (unsigned long)nextSequence);
+  return ok;
+}
+
+void RollupStore::catchUp(SegmentedLog &log)
+{
+  LogCursor cursor(log);
+  if (nextSequence > 0)
+  {
+    cursor.seekSequence(nextSequence);
+  }
+  else
+  {
+    cursor.seekSegment(0);
+  }
+  EventRecord record;
+  while (cursor.next(record))
+  {
+    add(record);
+  }
+  cursor.close();
+}
+
+void RollupStore::tierPath(size_t resolution, char *out, size_t capacity) const
+{
+  snprintf(out, capacity, "%s/%s", directory, TIER_NAMES[resolution]);
+}
+
+bool RollupStore::openTier(size_t resolution, bool recreate)
+{
+  Tier &tier = tiers[resolution];
+  char path[MAX_PATH_LENGTH];
+  tierPath(resolution, path, sizeof(path));
+
+  uint8_t header[TIER_HEADER_SIZE] = {};
+  memcpy(header, TIER_MAGIC, sizeof(TIER_MAGIC));
+  header[4] = TIER_VERSION;
+  header[5] = (uint8_t)channels;
+  header[6] = (uint8_t)resolution;
+  memcpy(header + 8, &tier.capacity, sizeof(tier.capacity));
+  uint32_t crc = crc32(header, 12);
+  memcpy(header + 12, &crc, sizeof(crc));
+
+  size_t fileSize = TIER_HEADER_SIZE + (size_t)tier.capacity * recordSize();
+  if (!recreate)
+  {
+    File existing = filesystem.open(path, FILE_READ);
+    uint8_t stored[TIER_HEADER_SIZE];
+    recreate = !existing || existing.size() != fileSize ||
+               existing.read(stored, sizeof(stored)) != sizeof(stored) ||
+               memcmp(stored, header, sizeof(header)) != 0;
+    existing.close();
+  }
+
+  if (recreate)
+  {
+    // Every slot is written up front, so later writes only ever seek
+    // within the file
+    File file = filesystem.open(path, FILE_WRITE);
+    if (!file)
+    {
+      Serial.printf("Failed to create %s\n", path);
+      return false;
+    }
+    file.write(header, sizeof(header));
+    uint8_t zeros[256] = {};
+    for (size_t left = fileSize - TIER_HEADER_SIZE; left > 0;)
+    {
+      size_t chunk = left < sizeof(zeros) ? left : sizeof(zeros);
+      file.write(zeros, chunk);
+      left -= chunk;
+    }
+    file.close();
+  }
+
+  tier.file = filesystem.open(path, "r+");
+  if (!tier.file)
+  {
+    Serial.printf("Failed to open %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+size_t RollupStore::slotOffset(const Tier &tier, uint32_t index) const
+{
+  return TIER_HEADER_SIZE + (size_t)(index % tier.capacity) * recordSize();
+}
+
+bool RollupStore::readSlot(File &file, const Tier &tier, uint32_t index, RollupBucket &bucket) const
+{
+  // Consecutive slots are read without seeking
+  size_t offset = slotOffset(tier, index);
+  if (file.position() != offset && !file.seek(offset))
+  {
+    return false;
+  }
+  uint8_t slot[4 + 4 * MAX_CHANNELS];
+  if (file.read(slot, recordSize()) != recordSize())
+  {
+    return false;
+  }
+  bucket = {};
+  memcpy(&bucket.start, slot, sizeof(bucket.start));
+  memcpy(bucket.pulses, slot + 4, 4 * channels);
+  return true;
+}
+
+void RollupStore::openBucket(size_t resolution, uint32_t index, uint32_t epoch)
+{
+  // A bucket written before, e.g. when the clock went back, carries on
+  // from what it held
+  Tier &tier = tiers[resolution];
+  RollupResolution kind = (RollupResolution)resolution;
+  if (!tier.file || !readSlot(tier.file, tier, index, tier.open) ||
+      tier.open.start == 0 || bucketIndex(kind, tier.open.start) != index)
+  {
+    tier.open = {};
+    tier.open.start = bucketStart(kind, epoch);
+  }
+  tier.openIndex = index;
+  tier.openEnds = bucketEnd(kind, epoch);
+  if (index > tier.newestIndex)
+  {
+    tier.newestIndex = index;
+  }
+}
+
+void RollupStore::closeBucket(size_t resolution)
+{
+  Tier &tier = tiers[resolution];
+  if (tier.open.start == 0)
+  {
+    return;
+  }
+  // Past retention the slot belongs to a newer bucket by now
+  if (tier.file && tier.newestIndex - tier.openIndex < tier.capacity)
+  {
+    uint8_t slot[4 + 4 * MAX_CHANNELS];
+    memcpy(slot, &tier.open.start, sizeof(tier.open.start));
+    memcpy(slot + 4, tier.open.pulses, 4 * channels);
+    tier.file.seek(slotOffset(tier, tier.openIndex));
+    tier.file.write(slot, recordSize());
+    tier.file.flush();
+  }
+  tier.open.start = 0;
+}
+
+void RollupStore::add(const EventRecord &record)
+{
+  std::lock_guard<std::mutex> lock(tierLock);
+  if (record.sequence < nextSequence || record.channel >= channels)
+  {
+    return;
+  }
+  nextSequence = record.sequence + 1;
+
+  // Records carry running counts. A count that went backwards belongs to
+  // records lost from the log tail, which were folded already. With the
+  // start of the count trimmed off the log, the first record is taken as
+  // one pulse, as it is for interrupt channels.
+  uint8_t channel = record.channel;
+  uint32_t pulses = !countKnown[channel]             ? 1
+                    : record.count > lastCount[channel] ? record.count - lastCount[channel]
+                                                        : 0;
+  lastCount[channel] = record.count;
+  countKnown[channel] = true;
+  if (pulses == 0 || !wallClockSetSeconds(record.epochSeconds()))
+  {
+    return;
+  }
+
+  bool minuteEnded = false;
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    Tier &tier = tiers[i];
+    uint32_t index = bucketIndex((RollupResolution)i, record.epochSeconds());
+    if (tier.open.start == 0 || index != tier.openIndex)
+    {
+      minuteEnded = minuteEnded || (i == 0 && tier.open.start != 0);
+      closeBucket(i);
+      openBucket(i, index, record.epochSeconds());
+    }
+    tier.open.pulses[channel] += pulses;
+  }
+  if (minuteEnded)
+  {
+    saveState();
+  }
+}
+
+void RollupStore::poll(uint32_t nowEpoch)
+{
+  std::lock_guard<std::mutex> lock(tierLock);
+  bool closed = false;
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    Tier &tier = tiers[i];
+    if (tier.open.start != 0 && wallClockSetSeconds(nowEpoch) && nowEpoch >= tier.openEnds)
+    {
+      closeBucket(i);
+      closed = true;
+    }
+  }
+  if (closed)
+  {
+    saveState();
+  }
+}
+
+void RollupStore::clear()
+{
+  std::lock_guard<std::mutex> lock(tierLock);
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    tiers[i].file.close();
+    openTier(i, true);
+    tiers[i].open.start = 0;
+    tiers[i].newestIndex = 0;
+  }
+  nextSequence = 0;
+  memset(lastCount, 0, sizeof(lastCount));
+  // Counts start over from 0 after a reset
+  memset(countKnown, 1, sizeof(countKnown));
+  saveState();
+}
+
+uint32_t RollupStore::read(RollupResolution resolution, uint32_t from, uint32_t to, size_t maxBuckets,
+                           const std::function<void(const RollupBucket &)> &visit)
+{
+  std::lock_guard<std::mutex> lock(tierLock);
+  const Tier &tier = tiers[(size_t)resolution];
+  uint32_t newest = tier.newestIndex;
+  if (from > to || newest == 0 || tier.capacity == 0)
+  {
+    return 0;
+  }
+  uint32_t first = bucketIndex(resolution, from);
+  uint32_t last = bucketIndex(resolution, to);
+  last = last < newest ? last : newest;
+  if (newest >= tier.capacity && first <= newest - tier.capacity)
+  {
+    first = newest - tier.capacity + 1;
+  }
+
+  // Own handle, as this runs on the web server task; the lock keeps a
+  // bucket from being written to its slot meanwhile
+  char path[MAX_PATH_LENGTH];
+  tierPath((size_t)resolution, path, sizeof(path));
+  File file = filesystem.open(path, FILE_READ);
+
+  size_t visited = 0;
+  for (uint32_t index = first; index <= last && index >= first; index++)
+  {
+    RollupBucket bucket;
+    if (tier.open.start != 0 && index == tier.openIndex)
+    {
+      bucket = tier.open;
+    }
+    else if (!file || !readSlot(file, tier, index, bucket) ||
+             bucket.start == 0 || bucketIndex(resolution, bucket.start) != index)
+    {
+      continue;
+    }
+    if (visited == maxBuckets)
+    {
+      return bucket.start;
+    }
+    visit(bucket);
+    visited++;
+  }
+  return 0;
+}
+
+bool RollupStore::loadState()
+{
+  char path[MAX_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/state", directory);
+  File file = filesystem.open(path, FILE_READ);
+  if (!file)
+  {
+    // The rename in saveState() did not happen
+    snprintf(path, sizeof(path), "%s/state.new", directory);
+    file = filesystem.open(path, FILE_READ);
+  }
+  if (!file)
+  {
+    return false;
+  }
+
+  uint8_t magic[4];
+  SavedState state;
+  uint32_t storedCrc = 0;
+  bool valid = file.read(magic, sizeof(magic)) == sizeof(magic) &&
+               memcmp(magic, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0 &&
+               file.read((uint8_t *)&state, sizeof(state)) == sizeof(state) &&
+               file.read((uint8_t *)&storedCrc, sizeof(storedCrc)) == sizeof(storedCrc) &&
+               storedCrc == crc32((const uint8_t *)&state, sizeof(state));
+  file.close();
+  if (!valid || state.channels != channels)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    if (state.capacity[i] != tiers[i].capacity)
+    {
+      return false;
+    }
+  }
+
+  nextSequence = state.nextSequence;
+  for (size_t channel = 0; channel < MAX_CHANNELS; channel++)
+  {
+    lastCount[channel] = state.lastCount[channel];
+    countKnown[channel] = state.countKnown[channel];
+  }
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    Tier &tier = tiers[i];
+    tier.open = state.open[i];
+    tier.openIndex = state.openIndex[i];
+    tier.openEnds = tier.open.start ? bucketEnd((RollupResolution)i, tier.open.start) : 0;
+    tier.newestIndex = state.newestIndex[i];
+  }
+  return true;
+}
+
+void RollupStore::saveState()
+{
+  SavedState state = {};
+  state.channels = channels;
+  state.nextSequence = nextSequence;
+  for (size_t channel = 0; channel < MAX_CHANNELS; channel++)
+  {
+    state.lastCount[channel] = lastCount[channel];
+    state.countKnown[channel] = countKnown[channel];
+  }
+  for (size_t i = 0; i < RESOLUTIONS; i++)
+  {
+    state.capacity[i] = tiers[i].capacity;
+    state.open[i] = tiers[i].open;
+    state.openIndex[i] = tiers[i].openIndex;
+    state.newestIndex[i] = tiers[i].newestIndex;
+  }
+  uint32_t crc = crc32((const uint8_t *)&state, sizeof(state));
+
+  // Written aside and renamed, so a power cut leaves one whole copy
+  char path[MAX_PATH_LENGTH];
+  char newPath[MAX_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/state", directory);
+  snprintf(newPath, sizeof(newPath), "%s/state.new", directory);
+  File file = filesystem.open(newPath, FILE_WRITE);
+  if (!file)
+  {
+    Serial.println("Failed to open rollup state for writing");
+    return;
+  }
+  file.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+  file.write((const uint8_t *)&state, sizeof(state));
+  file.write((const uint8_t *)&crc, sizeof(crc));
+  file.close();
+  // SPIFFS does not rename over an existing file
+  filesystem.remove(path);
+  filesystem.rename(newPath, path);
+}
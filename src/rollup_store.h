@@ -0,0 +1,132 @@
+#ifndef ROLLUP_STORE_H
+#define ROLLUP_STORE_H
+
+#include "hal/hal.h"
+#include <functional>
+#include <mutex>
+#include "event_codec.h"
+#include "event_record.h"
+#include "segmented_log.h"
+
+enum class RollupResolution : uint8_t
+{
+  Minute,
+  Hour,
+  Day // Local calendar day
+};
+
+// Buckets kept per resolution; the newest overwrites the oldest
+struct RollupRetention
+{
+  uint32_t minutes;
+  uint32_t hours;
+  uint32_t days;
+};
+
+// Pulses counted per channel in one bucket
+struct RollupBucket
+{
+  uint32_t start; // Epoch seconds, 0 for none
+  uint32_t pulses[4];
+};
+
+// Pulse totals per minute, hour and local day next to the raw log, so a
+// long graph reads one record per bucket instead of replaying every press.
+//
+// Each resolution is a ring file (<directory>/minute etc.) of fixed-size
+// slots behind a small header, a u32 start and a u32 per channel each.
+// Bucket i (minutes or hours since the epoch, local days since 1970) sits
+// in slot i % capacity, so a new bucket overwrites the one that fell out
+// of retention and a range is read by seeking straight to its slots.
+//
+// Buckets still filling stay in RAM and are written once they end. They
+// are saved in <directory>/state with the next sequence to fold whenever
+// a minute ends; at boot the records logged since are folded again from
+// the log, so a crash neither loses nor double counts a bucket. Records
+// stamped before the clock was set are left out.
+class RollupStore
+{
+public:
+  static const size_t MAX_CHANNELS = 4;
+  static const size_t RESOLUTIONS = 3;
+  static const size_t MAX_PATH_LENGTH = 32;
+
+  RollupStore(fs::FS &fs, const char *directory, size_t channels, RollupRetention retention);
+
+  // Opens or creates the files and folds the records logged after the
+  // saved state. Without one every rollup is rebuilt from the whole log.
+  bool begin(SegmentedLog &log);
+  // Folds a logged record into every resolution
+  void add(const EventRecord &record);
+  // Writes the buckets that ended by nowEpoch; call from the persistence task
+  void poll(uint32_t nowEpoch);
+  // Deletes every rollup, e.g. along with the log
+  void clear();
+
+  // Calls visit for each bucket overlapping [from, to] that holds pulses,
+  // oldest first, at most maxBuckets times. Returns the start of the
+  // bucket to continue from, 0 once the range is done. Safe from another
+  // task than add() and poll(); visit runs under the lock, so it must not
+  // call back into the store.
+  uint32_t read(RollupResolution resolution, uint32_t from, uint32_t to, size_t maxBuckets,
+                const std::function<void(const RollupBucket &)> &visit);
+
+  size_t channelCount() const { return channels; }
+  uint32_t capacity(RollupResolution resolution) const { return tiers[(size_t)resolution].capacity; }
+  // Nominal bucket length, a day counting as 86400 s
+  static uint32_t bucketSeconds(RollupResolution resolution);
+  static const char *resolutionName(RollupResolution resolution);
+  static bool parseResolution(const char *name, RollupResolution &resolution);
+
+private:
+  struct Tier
+  {
+    File file;
+    uint32_t capacity;
+    RollupBucket open;  // Still filling, open.start 0 when none
+    uint32_t openIndex;
+    uint32_t openEnds;  // Epoch the open bucket ends at
+    uint32_t newestIndex;
+  };
+
+  // Everything in RAM that is not in the ring files yet
+  struct SavedState
+  {
+    uint32_t channels;
+    uint32_t capacity[RESOLUTIONS];
+    uint32_t nextSequence;
+    uint32_t lastCount[MAX_CHANNELS];
+    uint8_t countKnown[MAX_CHANNELS];
+    RollupBucket open[RESOLUTIONS];
+    uint32_t openIndex[RESOLUTIONS];
+    uint32_t newestIndex[RESOLUTIONS];
+  };
+
+  static uint32_t bucketIndex(RollupResolution resolution, uint32_t epoch);
+  static uint32_t bucketStart(RollupResolution resolution, uint32_t epoch);
+  static uint32_t bucketEnd(RollupResolution resolution, uint32_t epoch);
+
+  bool openTier(size_t resolution, bool recreate);
+  void tierPath(size_t resolution, char *out, size_t capacity) const;
+  size_t recordSize() const { return 4 + 4 * channels; }
+  size_t slotOffset(const Tier &tier, uint32_t index) const;
+  bool readSlot(File &file, const Tier &tier, uint32_t index, RollupBucket &bucket) const;
+  void openBucket(size_t resolution, uint32_t index, uint32_t epoch);
+  void closeBucket(size_t resolution);
+  bool loadState();
+  void saveState();
+  void catchUp(SegmentedLog &log);
+
+  fs::FS &filesystem;
+  const char *directory;
+  size_t channels;
+  Tier tiers[RESOLUTIONS];
+  // Held by add(), poll() and clear() on the persistence task and read()
+  // on the web server task, around the tiers and their files
+  std::mutex tierLock;
+  uint32_t nextSequence = 0;
+  uint32_t lastCount[MAX_CHANNELS] = {};
+  bool countKnown[MAX_CHANNELS] = {};
+};
+
+#endif
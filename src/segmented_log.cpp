@@ -0,0 +1,402 @@
+#include "segmented_log.h"
+#include "event_codec.h"
+
+static const uint8_t MANIFEST_MAGIC[4] = {'P', 'M', 'A', 'N'};
+
+SegmentedLog::SegmentedLog(fs::FS &fs, const char *directory, const EventLogFormat &format,
+                           LogWriter &writer, size_t segmentSize, RetentionPolicy retention)
+    : filesystem(fs), directory(directory), format(format), writer(writer),
+      segmentSize(segmentSize), retention(retention)
+{
+}
+
+bool SegmentedLog::begin(const char *legacyPath)
+{
+  if (!loadManifest() && !rebuildManifest())
+  {
+    segments[0] = {0, 0, 0};
+    segmentTotal = 1;
+
+    // Carry an unsegmented log over as the first segment
+    char path[LogWriter::MAX_PATH_LENGTH];
+    segmentPath(0, path, sizeof(path));
+    EventRecord first;
+    if (legacyPath && filesystem.exists(legacyPath) && filesystem.rename(legacyPath, path) &&
+        readFirstRecord(0, first))
+    {
+      segments[0].firstSequence = first.sequence;
+      segments[0].firstEpoch = first.epochSeconds();
+      Serial.printf("Moved %s to %s\n", legacyPath, path);
+    }
+    saveManifest();
+  }
+
+  EventRecord first;
+  currentEmpty = !readFirstRecord(currentSegment(), first);
+
+  char path[LogWriter::MAX_PATH_LENGTH];
+  segmentPath(currentSegment(), path, sizeof(path));
+  return writer.reopen(path);
+}
+
+bool SegmentedLog::append(const EventRecord &record)
+{
+  if (currentEmpty)
+  {
+    segments[segmentTotal - 1].firstSequence = record.sequence;
+    segments[segmentTotal - 1].firstEpoch = record.epochSeconds();
+    currentEmpty = false;
+    saveManifest();
+  }
+  else if (writer.size() + writer.buffered() >= segmentSize)
+  {
+    rotate(record);
+  }
+  return writer.append(record);
+}
+
+void SegmentedLog::clear()
+{
+  writer.close();
+
+  char path[LogWriter::MAX_PATH_LENGTH];
+  for (size_t i = 0; i < segmentTotal; i++)
+  {
+    segmentPath(segments[i].index, path, sizeof(path));
+    filesystem.remove(path);
+  }
+
+  segments[0] = {0, 0, 0};
+  segmentTotal = 1;
+  currentEmpty = true;
+  saveManifest();
+
+  segmentPath(0, path, sizeof(path));
+  writer.reopen(path);
+}
+
+bool SegmentedLog::readLast(uint32_t fromSegment, size_t fromOffset, EventRecord &record, int channel)
+{
+  char path[LogWriter::MAX_PATH_LENGTH];
+  for (size_t i = segmentTotal; i-- > 0;)
+  {
+    uint32_t index = segments[i].index;
+    if (index < fromSegment)
+    {
+      break;
+    }
+
+    segmentPath(index, path, sizeof(path));
+    File file = filesystem.open(path, FILE_READ);
+    if (!file)
+    {
+      continue;
+    }
+
+    // A segment shorter than the checkpoint was replaced, so read all of it
+    size_t offset = index == fromSegment ? fromOffset : 0;
+    if (offset > file.size())
+    {
+      offset = 0;
+    }
+    bool found = format.readLast(file, offset, record, channel);
+    file.close();
+    if (found)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t SegmentedLog::findSequence(uint32_t sequence) const
+{
+  size_t position = 0;
+  while (position + 1 < segmentTotal && segments[position + 1].firstSequence <= sequence)
+  {
+    position++;
+  }
+  return position;
+}
+
+size_t SegmentedLog::findEpoch(uint32_t epoch) const
+{
+  size_t position = 0;
+  while (position + 1 < segmentTotal && segments[position + 1].firstEpoch <= epoch)
+  {
+    position++;
+  }
+  return position;
+}
+
+void SegmentedLog::segmentPath(uint32_t index, char *out, size_t capacity) const
+{
+  snprintf(out, capacity, "%s/%06lu.seg", directory, (unsigned long)index);
+}
+
+bool SegmentedLog::loadManifest()
+{
+  char path[LogWriter::MAX_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/manifest", directory);
+  File file = filesystem.open(path, FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+
+  uint8_t header[8];
+  uint32_t count = 0;
+  uint32_t storedCrc = 0;
+  bool valid = file.read(header, sizeof(header)) == sizeof(header) &&
+               memcmp(header, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) == 0;
+  if (valid)
+  {
+    memcpy(&count, header + 4, sizeof(count));
+    valid = count > 0 && count <= MAX_SEGMENTS &&
+            file.read((uint8_t *)segments, count * sizeof(SegmentInfo)) == count * sizeof(SegmentInfo) &&
+            file.read((uint8_t *)&storedCrc, sizeof(storedCrc)) == sizeof(storedCrc);
+  }
+  file.close();
+
+  if (!valid || storedCrc != crc32((const uint8_t *)segments, count * sizeof(SegmentInfo), crc32(header, sizeof(header))))
+  {
+    Serial.println("Log manifest missing or damaged");
+    return false;
+  }
+  segmentTotal = count;
+  return true;
+}
+
+bool SegmentedLog::rebuildManifest()
+{
+  // Recover the segment list from the files themselves
+  segmentTotal = 0;
+  File root = filesystem.open(directory);
+  if (!root)
+  {
+    return false;
+  }
+
+  File entry = root.openNextFile();
+  while (entry && segmentTotal < MAX_SEGMENTS)
+  {
+    const char *name = strrchr(entry.name(), '/');
+    name = name ? name + 1 : entry.name();
+    unsigned long index;
+    char extension[4];
+    if (sscanf(name, "%lu.%3s", &index, extension) == 2 && strcmp(extension, "seg") == 0)
+    {
+      // Keep the list sorted by segment number
+      size_t position = segmentTotal++;
+      while (position > 0 && segments[position - 1].index > index)
+      {
+        segments[position] = segments[position - 1];
+        position--;
+      }
+      segments[position] = {(uint32_t)index, 0, 0};
+    }
+    entry = root.openNextFile();
+  }
+  root.close();
+
+  for (size_t i = 0; i < segmentTotal; i++)
+  {
+    EventRecord first;
+    if (readFirstRecord(segments[i].index, first))
+    {
+      segments[i].firstSequence = first.sequence;
+      segments[i].firstEpoch = first.epochSeconds();
+    }
+  }
+
+  if (segmentTotal == 0)
+  {
+    return false;
+  }
+  Serial.printf("Log manifest rebuilt from %u segments\n", (unsigned)segmentTotal);
+  return saveManifest();
+}
+
+bool SegmentedLog::saveManifest()
+{
+  char path[LogWriter::MAX_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/manifest", directory);
+  File file = filesystem.open(path, FILE_WRITE);
+  if (!file)
+  {
+    Serial.println("Failed to open manifest for writing");
+    return false;
+  }
+
+  uint8_t header[8];
+  uint32_t count = segmentTotal;
+  memcpy(header, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+  memcpy(header + 4, &count, sizeof(count));
+  uint32_t crc = crc32((const uint8_t *)segments, count * sizeof(SegmentInfo), crc32(header, sizeof(header)));
+
+  file.write(header, sizeof(header));
+  file.write((const uint8_t *)segments, count * sizeof(SegmentInfo));
+  file.write((const uint8_t *)&crc, sizeof(crc));
+  file.close();
+  return true;
+}
+
+bool SegmentedLog::readFirstRecord(uint32_t index, EventRecord &record)
+{
+  char path[LogWriter::MAX_PATH_LENGTH];
+  segmentPath(index, path, sizeof(path));
+  File file = filesystem.open(path, FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+  bool found = format.open(file) && format.readNext(file, record);
+  file.close();
+  return found;
+}
+
+bool SegmentedLog::rotate(const EventRecord &first)
+{
+  if (segmentTotal == MAX_SEGMENTS)
+  {
+    removeOldest();
+  }
+
+  segments[segmentTotal] = {currentSegment() + 1, first.sequence, first.epochSeconds()};
+  segmentTotal++;
+  applyRetention(first.epochSeconds());
+  saveManifest();
+
+  char path[LogWriter::MAX_PATH_LENGTH];
+  segmentPath(currentSegment(), path, sizeof(path));
+  return writer.reopen(path);
+}
+
+void SegmentedLog::applyRetention(uint32_t nowEpoch)
+{
+  while (segmentTotal > 1)
+  {
+    // Closed segments are all close to segmentSize
+    bool tooBig = retention.maxBytes > 0 && segmentTotal * segmentSize > retention.maxBytes;
+    // Segment 0 ends where segment 1 starts
+    bool tooOld = retention.maxAgeSeconds > 0 &&
+                  segments[1].firstEpoch + retention.maxAgeSeconds < nowEpoch;
+    if (!tooBig && !tooOld)
+    {
+      break;
+    }
+    removeOldest();
+  }
+}
+
+void SegmentedLog::removeOldest()
+{
+  char path[LogWriter::MAX_PATH_LENGTH];
+  segmentPath(segments[0].index, path, sizeof(path));
+  filesystem.remove(path);
+  Serial.printf("Removed log segment %s\n", path);
+
+  memmove(segments, segments + 1, (segmentTotal - 1) * sizeof(SegmentInfo));
+  segmentTotal--;
+}
+
+// Cursor
+
+void LogCursor::seekSequence(uint32_t sequence)
+{
+  restart(log->findSequence(sequence));
+  minSequence = sequence;
+}
+
+void LogCursor::seekEpoch(uint32_t epoch)
+{
+  restart(log->findEpoch(epoch));
+  minEpochMillis = (int64_t)epoch * 1000;
+}
+
+void LogCursor::seekSegment(size_t position)
+{
+  restart(position < log->segmentCount() ? position : log->segmentCount() - 1);
+}
+
+bool LogCursor::next(EventRecord &record)
+{
+  if (!started)
+  {
+    restart(0);
+  }
+
+  while (true)
+  {
+    if (file && atEnd)
+    {
+      // Reading past the end leaves the stream at EOF, seeking clears it
+      file.seek(resumeOffset);
+      atEnd = false;
+    }
+
+    if (file || openSegment())
+    {
+      while (log->logFormat().readNext(file, record))
+      {
+        resumeOffset = file.position();
+        if (record.sequence >= minSequence && record.epochMillis >= minEpochMillis)
+        {
+          return true;
+        }
+      }
+
+      if (segmentIndex >= log->currentSegment())
+      {
+        atEnd = true;
+        return false;
+      }
+      file.close();
+    }
+    else if (segmentIndex >= log->currentSegment())
+    {
+      return false;
+    }
+    segmentIndex++;
+  }
+}
+
+void LogCursor::close()
+{
+  if (file)
+  {
+    file.close();
+  }
+  atEnd = false;
+}
+
+void LogCursor::restart(size_t position)
+{
+  close();
+  segmentIndex = log->segment(position).index;
+  minSequence = 0;
+  minEpochMillis = 0;
+  started = true;
+}
+
+bool LogCursor::openSegment()
+{
+  // Retention may have removed the segment, continue with the oldest left
+  if (segmentIndex < log->segment(0).index)
+  {
+    segmentIndex = log->segment(0).index;
+  }
+
+  char path[LogWriter::MAX_PATH_LENGTH];
+  log->segmentPath(segmentIndex, path, sizeof(path));
+  file = log->fileSystem().open(path, FILE_READ);
+  if (file && !log->logFormat().open(file))
+  {
+    file.close();
+  }
+  if (file)
+  {
+    resumeOffset = file.position();
+  }
+  return (bool)file;
+}
@@ -0,0 +1,114 @@
+#ifndef SEGMENTED_LOG_H
+#define SEGMENTED_LOG_H
+
+#include "hal/hal.h"
+#include "event_log_format.h"
+#include "event_record.h"
+#include "log_writer.h"
+
+// First record of a segment, as kept in the manifest
+struct SegmentInfo
+{
+  uint32_t index;
+  uint32_t firstSequence;
+  uint32_t firstEpoch;
+};
+
+// Oldest segments are deleted while either limit is exceeded; 0 disables a
+// limit. The segment being written is never deleted.
+struct RetentionPolicy
+{
+  size_t maxBytes;
+  uint32_t maxAgeSeconds;
+};
+
+// Button log split into numbered segment files (<directory>/000123.seg) of
+// about segmentSize bytes each. A small manifest records where every
+// segment starts, so readers open only the segments they need and
+// retention removes whole files.
+class SegmentedLog
+{
+public:
+  static const size_t MAX_SEGMENTS = 64;
+
+  SegmentedLog(fs::FS &fs, const char *directory, const EventLogFormat &format,
+               LogWriter &writer, size_t segmentSize, RetentionPolicy retention);
+
+  // Loads the manifest and opens the newest segment for appending. A log
+  // written before segmentation, found at legacyPath, becomes segment 0.
+  bool begin(const char *legacyPath);
+  bool append(const EventRecord &record);
+  // Deletes every segment and starts over
+  void clear();
+
+  // Last record at or after (segment, offset), newest segment first, of
+  // one channel when channel is not negative
+  bool readLast(uint32_t fromSegment, size_t fromOffset, EventRecord &record, int channel = -1);
+
+  size_t segmentCount() const { return segmentTotal; }
+  const SegmentInfo &segment(size_t position) const { return segments[position]; }
+  // Position in the manifest of the segment that holds sequence or epoch
+  size_t findSequence(uint32_t sequence) const;
+  size_t findEpoch(uint32_t epoch) const;
+  uint32_t currentSegment() const { return segments[segmentTotal - 1].index; }
+  size_t maxSegmentSize() const { return segmentSize; }
+
+  void segmentPath(uint32_t index, char *out, size_t capacity) const;
+  fs::FS &fileSystem() { return filesystem; }
+  const EventLogFormat &logFormat() const { return format; }
+
+private:
+  bool loadManifest();
+  bool rebuildManifest();
+  bool saveManifest();
+  bool readFirstRecord(uint32_t index, EventRecord &record);
+  bool rotate(const EventRecord &first);
+  void applyRetention(uint32_t nowEpoch);
+  void removeOldest();
+
+  fs::FS &filesystem;
+  const char *directory;
+  const EventLogFormat &format;
+  LogWriter &writer;
+  size_t segmentSize;
+  RetentionPolicy retention;
+  SegmentInfo segments[MAX_SEGMENTS];
+  size_t segmentTotal = 0;
+  bool currentEmpty = true;
+};
+
+// Reads records across segments in order, opening one segment at a time.
+// At the end of the newest segment the cursor keeps its place, so a later
+// next() picks up records appended since.
+class LogCursor
+{
+public:
+  LogCursor() {}
+  explicit LogCursor(SegmentedLog &log) : log(&log) {}
+  ~LogCursor() { close(); }
+
+  void attach(SegmentedLog &log) { this->log = &log; }
+
+  // Skip straight to the segment holding the first wanted record
+  void seekSequence(uint32_t sequence);
+  void seekEpoch(uint32_t epoch);
+  // Start at the segment at this manifest position
+  void seekSegment(size_t position);
+  bool next(EventRecord &record);
+  void close();
+
+private:
+  bool openSegment();
+  void restart(size_t position);
+
+  SegmentedLog *log = nullptr;
+  uint32_t segmentIndex = 0;
+  File file;
+  size_t resumeOffset = 0;
+  bool atEnd = false;
+  bool started = false;
+  uint32_t minSequence = 0;
+  int64_t minEpochMillis = 0;
+};
+
+#endif
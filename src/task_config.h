@@ -0,0 +1,15 @@
+#ifndef TASK_CONFIG_H
+#define TASK_CONFIG_H
+
+#include <stdint.h>
+
+// Where and how urgently one of the firmware's FreeRTOS tasks runs
+struct TaskConfig
+{
+  const char *name;
+  uint8_t core;        // WiFi and lwIP live on core 0, loop() on core 1
+  uint8_t priority;    // loop() runs at 1, the WiFi task at 23
+  uint32_t stackBytes;
+};
+
+#endif
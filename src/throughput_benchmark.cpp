@@ -0,0 +1,156 @@
+#include "throughput_benchmark.h"
+
+const uint32_t ThroughputBenchmark::RATES[RATE_COUNT] = {
+    10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+
+ThroughputBenchmark::ThroughputBenchmark(PressPipeline &pipeline, HistoryReplay &replay,
+                                         LogWriter &writer, AsyncWebSocket &ws)
+    : pipeline(pipeline), replay(replay), writer(writer), ws(ws)
+{
+}
+
+uint32_t ThroughputBenchmark::run(unsigned long stepMs)
+{
+  pipeline.setVerbose(false);
+
+  uint32_t sustained = 0;
+  uint32_t saturation = 0;
+  for (size_t i = 0; i < RATE_COUNT; i++)
+  {
+    BenchmarkStep step = runStep(RATES[i], stepMs);
+    printStep(step);
+    if (step.saturated)
+    {
+      saturation = RATES[i];
+      break;
+    }
+    sustained = RATES[i];
+  }
+
+  Serial.printf("BENCH {\"summary\":true,\"sustainedRate\":%lu,\"saturationRate\":%lu,"
+                "\"clients\":%u,\"batchSize\":%u,\"batchWindowMs\":%lu,\"stepMs\":%lu}\n",
+                (unsigned long)sustained, (unsigned long)saturation, (unsigned)ws.count(),
+                (unsigned)pipeline.batching().maxSize, pipeline.batching().windowMs, stepMs);
+  return sustained;
+}
+
+BenchmarkStep ThroughputBenchmark::runStep(uint32_t rate, unsigned long stepMs)
+{
+  BenchmarkStep step = {};
+  step.rate = rate;
+  ulong countBefore = pipeline.count();
+  uint32_t droppedBefore = pipeline.droppedPulses();
+  LogWriterStats writerBefore = writer.stats();
+
+  unsigned long start = micros();
+  unsigned long elapsed = 0;
+  while ((elapsed = micros() - start) < stepMs * 1000)
+  {
+    // Every pulse that is due by now, however many that is
+    uint32_t due = (uint32_t)((uint64_t)elapsed * rate / 1000000);
+    while (step.injected < due)
+    {
+      pipeline.injectPulse(hal::monotonicMicros());
+      step.injected++;
+    }
+    runLoopPass(step);
+  }
+  step.elapsedMs = elapsed / 1000;
+  settle(step);
+
+  const LogWriterStats &writerAfter = writer.stats();
+  step.counted = pipeline.count() - countBefore;
+  step.dropped = pipeline.droppedPulses() - droppedBefore;
+  step.logged = writerAfter.appends - writerBefore.appends;
+  step.flushes = writerAfter.flushes - writerBefore.flushes;
+  step.flushMicros = writerAfter.totalFlushMicros - writerBefore.totalFlushMicros;
+  step.saturated = step.dropped > 0 || step.logged < step.injected;
+  return step;
+}
+
+void ThroughputBenchmark::runLoopPass(BenchmarkStep &step)
+{
+  // Most passes find nothing to do, so a stage is only timed on passes
+  // where it moved something; otherwise the figures measure the spin
+  uint32_t backlogBefore = pipeline.pulseBacklog();
+  uint32_t pendingBefore = pipeline.pendingRecords();
+  uint32_t flushesBefore = writer.stats().flushes;
+
+  unsigned long start = micros();
+  pipeline.capture();
+  unsigned long captured = micros();
+  replay.pump();
+  unsigned long replayed = micros();
+  pipeline.process();
+  unsigned long processed = micros();
+  writer.poll();
+  unsigned long polled = micros();
+  uint32_t queued = 0;
+  for (AsyncWebSocketClient &client : ws.getClients())
+  {
+    queued = client.queueLen() > queued ? client.queueLen() : queued;
+  }
+  step.maxSocketQueue = queued > step.maxSocketQueue ? queued : step.maxSocketQueue;
+  unsigned long delivering = micros();
+  if (deliver)
+  {
+    deliver();
+  }
+  unsigned long delivered = micros();
+
+  if (backlogBefore > 0)
+  {
+    step.captureMicros += captured - start;
+  }
+  if (pipeline.pendingRecords() < pendingBefore + backlogBefore)
+  {
+    step.processMicros += processed - replayed;
+  }
+  if (writer.stats().flushes != flushesBefore)
+  {
+    step.pollMicros += polled - processed;
+  }
+  if (queued > 0)
+  {
+    step.deliveryMicros += delivered - delivering;
+  }
+
+  step.maxPulseBacklog = backlogBefore > step.maxPulseBacklog ? backlogBefore : step.maxPulseBacklog;
+  step.maxPending = pendingBefore > step.maxPending ? pendingBefore : step.maxPending;
+  if (backgroundWork)
+  {
+    backgroundWork();
+  }
+  yield();
+}
+
+void ThroughputBenchmark::settle(BenchmarkStep &step)
+{
+  // Let the last batch window run out, then put everything on flash
+  unsigned long start = millis();
+  while ((pipeline.pulseBacklog() > 0 || pipeline.pendingRecords() > 0) &&
+         millis() - start <= pipeline.batching().windowMs + 100)
+  {
+    runLoopPass(step);
+  }
+  writer.sync();
+}
+
+void ThroughputBenchmark::printStep(const BenchmarkStep &step) const
+{
+  // Stage times are per pulse that made it through
+  double per = step.counted ? 1.0 / step.counted : 0;
+  Serial.printf("BENCH {\"rate\":%lu,\"injected\":%lu,\"counted\":%lu,\"dropped\":%lu,"
+                "\"logged\":%lu,\"achievedRate\":%lu,\"flushes\":%lu,"
+                "\"captureUs\":%.2f,\"processUs\":%.2f,\"pollUs\":%.2f,"
+                "\"deliveryUs\":%.2f,\"flushUs\":%.2f,\"maxPulseBacklog\":%lu,\"maxPending\":%lu,"
+                "\"maxSocketQueue\":%lu,\"saturated\":%s}\n",
+                (unsigned long)step.rate, (unsigned long)step.injected, (unsigned long)step.counted,
+                (unsigned long)step.dropped, (unsigned long)step.logged,
+                (unsigned long)(step.elapsedMs ? (uint64_t)step.logged * 1000 / step.elapsedMs : 0),
+                (unsigned long)step.flushes,
+                step.captureMicros * per, step.processMicros * per,
+                step.pollMicros * per, step.deliveryMicros * per, step.flushMicros * per,
+                (unsigned long)step.maxPulseBacklog, (unsigned long)step.maxPending,
+                (unsigned long)step.maxSocketQueue, step.saturated ? "true" : "false");
+}
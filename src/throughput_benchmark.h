@@ -0,0 +1,72 @@
+#ifndef THROUGHPUT_BENCHMARK_H
+#define THROUGHPUT_BENCHMARK_H
+
+#include "hal/hal.h"
+#include <functional>
+#include "history_replay.h"
+#include "log_writer.h"
+#include "press_pipeline.h"
+
+struct BenchmarkStep
+{
+  uint32_t rate; // Offered pulses per second
+  uint32_t injected;
+  uint32_t counted;
+  uint32_t dropped;
+  uint32_t logged;
+  uint32_t flushes;
+  uint32_t elapsedMs;
+  // Time spent in the loop() stages that had work, and writing to flash
+  uint64_t captureMicros;
+  uint64_t processMicros;
+  uint64_t pollMicros;
+  uint64_t deliveryMicros;
+  uint64_t flushMicros;
+  // Deepest the queues got
+  uint32_t maxPulseBacklog;
+  uint32_t maxPending;
+  uint32_t maxSocketQueue;
+  bool saturated;
+};
+
+// Drives a PressPipeline at increasing pulse rates until it saturates,
+// i.e. a pulse is dropped or still unlogged once the step has settled.
+// Pulses are injected from the loop on a micros() schedule, so a slow pass
+// shows up as a burst in the pulse ring the way a busy loop() would.
+//
+// Each step prints one "BENCH {...}" JSON line on Serial, then a summary
+// line, for scripts to pick out of the log. Blocks for about
+// (stepMs + batch window) per step.
+class ThroughputBenchmark
+{
+public:
+  static const size_t RATE_COUNT = 12;
+  static const uint32_t RATES[RATE_COUNT];
+
+  ThroughputBenchmark(PressPipeline &pipeline, HistoryReplay &replay, LogWriter &writer, AsyncWebSocket &ws);
+
+  // Work the network task would do on the device, e.g. draining loopback
+  // sockets on the host
+  void setDelivery(std::function<void()> deliver) { this->deliver = deliver; }
+  // Work the benchmark's task still owes the live pipeline, run after
+  // every loop pass and not timed
+  void setBackgroundWork(std::function<void()> work) { backgroundWork = work; }
+
+  // Returns the highest rate that did not saturate, 0 if none
+  uint32_t run(unsigned long stepMs);
+
+private:
+  BenchmarkStep runStep(uint32_t rate, unsigned long stepMs);
+  void runLoopPass(BenchmarkStep &step);
+  void settle(BenchmarkStep &step);
+  void printStep(const BenchmarkStep &step) const;
+
+  PressPipeline &pipeline;
+  HistoryReplay &replay;
+  LogWriter &writer;
+  AsyncWebSocket &ws;
+  std::function<void()> deliver;
+  std::function<void()> backgroundWork;
+};
+
+#endif
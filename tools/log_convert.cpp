@@ -0,0 +1,159 @@
+// Converts a button log between the JSON-lines and binary formats, and
+// exports either as CSV.
+//
+// Build on the host:
+//   g++ -std=c++17 -Isrc tools/log_convert.cpp src/event_codec.cpp -o log_convert
+//
+// Usage:
+//   log_convert to-binary ButtonLog.txt ButtonLog.bin
+//   log_convert to-json ButtonLog.bin ButtonLog.txt
+//   log_convert to-json ButtonLog.txt ButtonLog.new  (rewrites old lines)
+//   log_convert to-csv ButtonLog.bin ButtonLog.csv
+//
+// Lines logged before records carried epoch milliseconds hold local-time
+// strings, and the CSV shows local time, so run it with TZ set to the
+// device's zone (e.g. TZ=CET-1CEST,M3.5.0,M10.5.0/3).
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include "event_codec.h"
+
+typedef std::function<void(const EventRecord &)> RecordVisitor;
+
+// Lines logged before "seq" existed are numbered in file order
+static int readJson(FILE *in, const RecordVisitor &visit)
+{
+  char line[256];
+  uint32_t sequence = 0;
+  unsigned long skipped = 0;
+  while (fgets(line, sizeof(line), in))
+  {
+    EventRecord record = {};
+    if (!decodeEventJson(line, record))
+    {
+      skipped++;
+      continue;
+    }
+    if (!strstr(line, "\"seq\":"))
+    {
+      record.sequence = sequence;
+    }
+    sequence++;
+    visit(record);
+  }
+
+  fprintf(stderr, "%lu records converted, %lu lines skipped\n", (unsigned long)sequence, skipped);
+  return 0;
+}
+
+static int readBinary(FILE *in, const RecordVisitor &visit)
+{
+  uint8_t bytes[BINARY_LOG_RECORD_SIZE];
+  if (fread(bytes, 1, BINARY_LOG_HEADER_SIZE, in) != BINARY_LOG_HEADER_SIZE ||
+      !decodeBinaryLogHeader(bytes))
+  {
+    fprintf(stderr, "Not a binary button log\n");
+    return 1;
+  }
+
+  unsigned long converted = 0;
+  unsigned long damaged = 0;
+  while (fread(bytes, 1, BINARY_LOG_RECORD_SIZE, in) == BINARY_LOG_RECORD_SIZE)
+  {
+    EventRecord record;
+    if (!decodeEventBinary(bytes, record))
+    {
+      damaged++;
+      continue;
+    }
+    visit(record);
+    converted++;
+  }
+
+  fprintf(stderr, "%lu records converted, %lu damaged records skipped\n", converted, damaged);
+  return 0;
+}
+
+// Either format, told apart by the binary header's magic
+static int readLog(FILE *in, const RecordVisitor &visit)
+{
+  char magic[4] = {};
+  bool binary = fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, "PLOG", 4) == 0;
+  rewind(in);
+  return binary ? readBinary(in, visit) : readJson(in, visit);
+}
+
+static int toBinary(FILE *in, FILE *out)
+{
+  uint8_t bytes[BINARY_LOG_RECORD_SIZE];
+  fwrite(bytes, 1, encodeBinaryLogHeader(bytes), out);
+  return readLog(in, [&](const EventRecord &record)
+  {
+    fwrite(bytes, 1, encodeEventBinary(record, bytes), out);
+  });
+}
+
+static int toJson(FILE *in, FILE *out)
+{
+  return readLog(in, [&](const EventRecord &record)
+  {
+    char json[EVENT_JSON_MAX_LENGTH];
+    encodeEventJson(record, json, sizeof(json));
+    fprintf(out, "%s\n", json);
+  });
+}
+
+// The only place a press time becomes a local date string
+static int toCsv(FILE *in, FILE *out)
+{
+  fprintf(out, "seq,channel,epoch_ms,local_time,count\n");
+  return readLog(in, [&](const EventRecord &record)
+  {
+    time_t epoch = (time_t)(record.epochMillis / 1000);
+    struct tm timeinfo;
+    localtime_r(&epoch, &timeinfo);
+    char timestamp[20];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    fprintf(out, "%lu,%u,%lld,%s.%03u,%lu\n", (unsigned long)record.sequence, (unsigned)record.channel,
+            (long long)record.epochMillis, timestamp, (unsigned)(record.epochMillis % 1000),
+            (unsigned long)record.count);
+  });
+}
+
+int main(int argc, char **argv)
+{
+  int (*convert)(FILE *, FILE *) = nullptr;
+  if (argc == 4)
+  {
+    convert = strcmp(argv[1], "to-binary") == 0 ? toBinary
+              : strcmp(argv[1], "to-json") == 0 ? toJson
+              : strcmp(argv[1], "to-csv") == 0  ? toCsv
+                                                 : nullptr;
+  }
+  if (!convert)
+  {
+    fprintf(stderr, "Usage: %s to-binary|to-json|to-csv <input> <output>\n", argv[0]);
+    return 2;
+  }
+
+  FILE *in = fopen(argv[2], "rb");
+  if (!in)
+  {
+    perror(argv[2]);
+    return 1;
+  }
+  FILE *out = fopen(argv[3], convert == toBinary ? "wb" : "w");
+  if (!out)
+  {
+    perror(argv[3]);
+    fclose(in);
+    return 1;
+  }
+
+  int result = convert(in, out);
+  fclose(in);
+  fclose(out);
+  return result;
+}